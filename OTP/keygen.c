@@ -5,91 +5,500 @@
  Date: March 1, 2018
  Description: This program creates a key file of a specified length. The characters
      in the file generated are any of the permitted 27 (i.e. all 26 capital
-     alphabet letters plus space), as generated using the standard UNIX randomization
-     methods. The last character the program outputs is a newline. All error text,
-     if any, is output to stderr.
-     The syntax for keygen is: keygen <keylength>
+     alphabet letters plus space). They are drawn from a ChaCha20 keystream keyed
+     with 256 bits from getrandom(), so the key is unpredictable rather than the
+     output of rand(). Keystream bytes are mapped to the 27 chars by rejection
+     sampling: bytes 243-255 are discarded and the rest taken mod 27 (243 = 9 * 27),
+     so every char is equally likely. The key is cut into 1 MB slices, each drawn
+     from its own ChaCha20 stream (the slice number is the stream's nonce), so
+     slices are independent and never share keystream. With --threads N the
+     slices are shared out among N threads. When stdout is a regular file it is
+     preallocated and every thread pwrite()s its slices straight into place;
+     otherwise rounds of N slices are generated in parallel and written in order.
+     Either way memory use is constant for keys of any length (multi-GB pads
+     included). With --seed <hex> (up to 64 hex digits, the 256-bit ChaCha20 key)
+     the output is reproducible, and identical for any number of threads. The
+     last character the program outputs is a newline. With --pad the key is
+     written as a pad file instead (a header with a consumed-offset watermark,
+     then the raw key chars, no newline; see otp_pad.h), which otp_enc/otp_dec
+     --pad consume a message at a time. All error text, if any, is output to
+     stderr.
+     The syntax for keygen is: keygen <keylength> [--threads N] [--seed <hex>]
+     [--pad]
      Where keylength is the length of the key file in characters. keygen outputs
      to stdout.
+ Reference Citation: https://cr.yp.to/chacha/chacha-20080128.pdf
+ Reference Citation: http://man7.org/linux/man-pages/man2/getrandom.2.html
  *********************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "otp_pad.h"
 
+#define KEY_SYMBOLS 27          // Space plus 'A'-'Z'
+#define REJECT_LIMIT 243        // Largest multiple of 27 not above 256
+#define SLICE_SIZE (1 << 20)    // Key chars per slice (one ChaCha20 stream each)
+#define THREADS_MAX 256         // Upper bound for --threads
+#define CHACHA_ROUNDS 20
+#define CHACHA_LANES 8          // Blocks computed side by side (vectorized by the compiler)
+#define KEYSTREAM_SIZE (64 * CHACHA_LANES)
+
+// ChaCha20 keystream generator
+struct KeyRng {
+    unsigned int state[16];     // Constants, 256-bit key, 64-bit counter, 64-bit nonce
+    unsigned char block[KEYSTREAM_SIZE];    // Current keystream blocks
+    int blockPos;               // Next unused byte of block
+};
+
+// Key being produced, shared by every thread
+struct KeyJob {
+    long long keyLen;
+    long long numSlices;
+    int numThreads;
+    unsigned char seed[32];     // ChaCha20 key
+    int padFormat;              // 1 to write a pad file (--pad)
+    int outFd;
+    off_t outBase;              // File offset of the key (pwrite() mode), else -1
+};
+
+// One generating thread
+struct KeyThread {
+    pthread_t thread;
+    struct KeyJob* job;
+    long long firstSlice;       // Slices firstSlice, firstSlice + step, ...
+    long long step;
+    long long lastSlice;        // Exclusive bound
+    char* buff;                 // One slice
+    size_t buffLen;             // Chars of the slice last generated
+};
 
 // Function Prototypes
-char* produceKey(int keyLen);
-char genRandChar(void);
+void parseSeed(const char* hex, unsigned char* seed);
+void seedRng(struct KeyRng* rng, const unsigned char* seed, unsigned long long streamIdx);
+void nextBlock(struct KeyRng* rng);
+char genRandChar(struct KeyRng* rng);
+size_t fillKeyChars(struct KeyRng* rng, char* buff, size_t len);
+size_t genSlice(struct KeyJob* job, long long sliceIdx, char* buff);
+void* keyWorker(void* arg);
+void produceKey(struct KeyJob* job);
+void writeAll(int fd, const char* data, size_t len, off_t offset);
 
-#define ASCII_MIN 64    // @ NOTE: @ will be replaced with space if encountered
-#define ASCII_MAX 90    // Z
+static char symbolOf[256];      // Key char of each accepted keystream byte
 
 
 /****************************************************************************
  MAIN
  ****************************************************************************/
 int main(int argc, const char * argv[]) {
-    int keyLen;
-    char* encryptionKey;
-    
-    // Seed rand
-    unsigned int seed = (unsigned int) (time(0));
-    srand(seed);
-    
-    keyLen = atoi(argv[1]); // Store requested length
+    struct KeyJob job;
+    char* end;
+    int i, haveLen = 0, haveSeed = 0;
+    size_t filled = 0;
+    ssize_t got;
+
+    job.numThreads = 1;
+    job.padFormat = 0;
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            job.numThreads = atoi(argv[++i]);
+            if(job.numThreads < 1 || job.numThreads > THREADS_MAX) {
+                fprintf(stderr, "Number of threads must be between 1 and %d.\n", THREADS_MAX);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            parseSeed(argv[++i], job.seed);
+            haveSeed = 1;
+        }
+        else if(strcmp(argv[i], "--pad") == 0) {
+            job.padFormat = 1;
+        }
+        else if(!haveLen && argv[i][0] != '-') {
+            job.keyLen = strtoll(argv[i], &end, 10);    // Store requested length
+            if(*end != '\0' || job.keyLen < 0)
+            {
+                fprintf(stderr, "Invalid key length: %s\n", argv[i]);
+                exit(1);
+            }
+            haveLen = 1;
+        }
+        else {
+            fprintf(stderr, "Unrecognized argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
     // Ensure a key length recvd from cmd line
-    if(argc < 2)
+    if(!haveLen)
     {
         fprintf(stderr, "Expected a key length argument.\n");
         exit(1);
     }
-    
-    encryptionKey = produceKey(keyLen); // Generate key
-    
-    // Print key
-    printf("%s", encryptionKey);
-    
-    free(encryptionKey); // Deallocate memory
+
+    // Without --seed the ChaCha20 key comes from the kernel's CSPRNG
+    while(!haveSeed && filled < sizeof(job.seed))
+    {
+        got = getrandom(job.seed + filled, sizeof(job.seed) - filled, 0);
+        if(got == -1) {
+            if(errno == EINTR) { continue; }
+            fprintf(stderr, "Error from getrandom() call.\n");
+            exit(1);
+        }
+        filled += got;
+    }
+
+    produceKey(&job);       // Generate and output key
+    memset(job.seed, 0, sizeof(job.seed));
     return 0;
 }
 
 
+/****************************************************************************
+ * Function Name: parseSeed
+ * Description: This function reads up to 64 hex digits into the 32-byte
+    ChaCha20 key (shorter seeds are zero-padded on the right).
+ ****************************************************************************/
+void parseSeed(const char* hex, unsigned char* seed)
+{
+    int i, nibble;
+
+    memset(seed, 0, 32);
+    for(i = 0; hex[i] != '\0'; i++)
+    {
+        if(i == 64) {
+            fprintf(stderr, "Seed is longer than 64 hex digits.\n");
+            exit(1);
+        }
+        if(hex[i] >= '0' && hex[i] <= '9') { nibble = hex[i] - '0'; }
+        else if(hex[i] >= 'a' && hex[i] <= 'f') { nibble = hex[i] - 'a' + 10; }
+        else if(hex[i] >= 'A' && hex[i] <= 'F') { nibble = hex[i] - 'A' + 10; }
+        else {
+            fprintf(stderr, "Seed must be hex digits: %s\n", hex);
+            exit(1);
+        }
+        seed[i / 2] |= (i % 2 == 0) ? nibble << 4 : nibble;
+    }
+}
+
+
+/****************************************************************************
+ * Function Name: seedRng
+ * Description: This function sets the ChaCha20 generator to stream
+    streamIdx of the 256-bit seed (the stream index is the 64-bit nonce),
+    starting at block 0.
+ ****************************************************************************/
+void seedRng(struct KeyRng* rng, const unsigned char* seed, unsigned long long streamIdx)
+{
+    int i;
+
+    rng->state[0] = 0x61707865;     // "expand 32-byte k"
+    rng->state[1] = 0x3320646e;
+    rng->state[2] = 0x79622d32;
+    rng->state[3] = 0x6b206574;
+    for(i = 0; i < 8; i++) {        // Key words are little endian
+        rng->state[4 + i] = seed[4 * i] | (seed[4 * i + 1] << 8) |
+                            (seed[4 * i + 2] << 16) | ((unsigned int) seed[4 * i + 3] << 24);
+    }
+    rng->state[12] = rng->state[13] = 0;    // Block counter
+    rng->state[14] = (unsigned int) streamIdx;
+    rng->state[15] = (unsigned int) (streamIdx >> 32);
+
+    rng->blockPos = sizeof(rng->block);     // No keystream yet
+}
+
+
+// One ChaCha step applied to every lane
+#define LANE_STEP(a, b, d, n) \
+    for(l = 0; l < CHACHA_LANES; l++) { \
+        a[l] += b[l]; d[l] ^= a[l]; d[l] = (d[l] << (n)) | (d[l] >> (32 - (n))); \
+    }
+#define QUARTER_ROUND(a, b, c, d) \
+    LANE_STEP(x[a], x[b], x[d], 16) \
+    LANE_STEP(x[c], x[d], x[b], 12) \
+    LANE_STEP(x[a], x[b], x[d], 8) \
+    LANE_STEP(x[c], x[d], x[b], 7)
+
+/****************************************************************************
+ * Function Name: nextBlock
+ * Description: This function computes the next CHACHA_LANES 64-byte ChaCha20
+    keystream blocks and advances the 64-bit block counter past them. The
+    blocks are computed word by word across lanes so the compiler can keep
+    them in SIMD registers; an AVX2 build is picked at load time where the
+    CPU supports it.
+ ****************************************************************************/
+__attribute__((target_clones("avx2", "default")))
+void nextBlock(struct KeyRng* rng)
+{
+    unsigned int x[16][CHACHA_LANES];
+    unsigned long long counter;
+    unsigned int word;
+    int i, l;
+
+    counter = rng->state[12] | ((unsigned long long) rng->state[13] << 32);
+    for(i = 0; i < 16; i++) {
+        for(l = 0; l < CHACHA_LANES; l++) {
+            x[i][l] = rng->state[i];
+        }
+    }
+    for(l = 0; l < CHACHA_LANES; l++) {     // Each lane is the next block
+        x[12][l] = (unsigned int) (counter + l);
+        x[13][l] = (unsigned int) ((counter + l) >> 32);
+    }
+
+    for(i = 0; i < CHACHA_ROUNDS; i += 2)
+    {
+        QUARTER_ROUND(0, 4, 8,  12);    // Column round
+        QUARTER_ROUND(1, 5, 9,  13);
+        QUARTER_ROUND(2, 6, 10, 14);
+        QUARTER_ROUND(3, 7, 11, 15);
+        QUARTER_ROUND(0, 5, 10, 15);    // Diagonal round
+        QUARTER_ROUND(1, 6, 11, 12);
+        QUARTER_ROUND(2, 7, 8,  13);
+        QUARTER_ROUND(3, 4, 9,  14);
+    }
+
+    for(l = 0; l < CHACHA_LANES; l++) {
+        for(i = 0; i < 16; i++) {
+            word = htole32(x[i][l] + ((i == 12) ? (unsigned int) (counter + l) :
+                                      (i == 13) ? (unsigned int) ((counter + l) >> 32) : rng->state[i]));
+            memcpy(rng->block + 64 * l + 4 * i, &word, sizeof(word));   // Keystream is little endian
+        }
+    }
+
+    counter += CHACHA_LANES;
+    rng->state[12] = (unsigned int) counter;
+    rng->state[13] = (unsigned int) (counter >> 32);
+    rng->blockPos = 0;
+}
+
+
 /****************************************************************************
  * Function Name: genRandChar
  * Description: This function generates and returns a random caplital alphabet
-    character or a space.
+    character or a space, each with probability exactly 1/27.
  ****************************************************************************/
-char genRandChar()
+char genRandChar(struct KeyRng* rng)
 {
-    char nextChar;
-    // Generate and return a random cap letter
-    nextChar = rand() % ((ASCII_MAX + 1) - ASCII_MIN) + ASCII_MIN;
-    
-    // Replace '@' with a space
-    if(nextChar == 64)  // i.e. ASCII '@'
+    unsigned char nextByte;
+
+    do {
+        if(rng->blockPos == sizeof(rng->block)) {
+            nextBlock(rng);
+        }
+        nextByte = rng->block[rng->blockPos++];
+    } while(nextByte >= REJECT_LIMIT);     // Unbiased: reject the partial last group
+
+    nextByte %= KEY_SYMBOLS;
+    return (nextByte == 0) ? ' ' : (char) ('A' + nextByte - 1);
+}
+
+
+/****************************************************************************
+ * Function Name: fillKeyChars
+ * Description: This function fills buff with up to len key chars, taking
+    whole keystream batches with a branch-free rejection loop (every byte is
+    stored, but the output position only advances for accepted bytes).
+    Returns the number of chars produced; the caller finishes the last few
+    with genRandChar().
+ ****************************************************************************/
+size_t fillKeyChars(struct KeyRng* rng, char* buff, size_t len)
+{
+    const unsigned char* keystream = rng->block;
+    size_t done = 0;
+    char* out;
+    int b;
+
+    while(done + KEYSTREAM_SIZE <= len)     // A batch can yield at most KEYSTREAM_SIZE chars
     {
-        nextChar = 32;  // i.e. ASCII ' '
+        nextBlock(rng);
+        out = buff + done;
+        for(b = 0; b < KEYSTREAM_SIZE; b++) {
+            *out = symbolOf[keystream[b]];
+            out += (keystream[b] < REJECT_LIMIT);
+        }
+        done = out - buff;
+    }
+    rng->blockPos = KEYSTREAM_SIZE;     // Batches are used up
+    return done;
+}
+
+
+/****************************************************************************
+ * Function Name: genSlice
+ * Description: This function generates slice sliceIdx of the key into buff
+    and returns its length (SLICE_SIZE except for the last slice).
+ ****************************************************************************/
+size_t genSlice(struct KeyJob* job, long long sliceIdx, char* buff)
+{
+    struct KeyRng rng;
+    long long left = job->keyLen - sliceIdx * SLICE_SIZE;
+    size_t len = (left < SLICE_SIZE) ? (size_t) left : SLICE_SIZE;
+    size_t i;
+
+    seedRng(&rng, job->seed, (unsigned long long) sliceIdx);
+    for(i = fillKeyChars(&rng, buff, len); i < len; i++) {
+        buff[i] = genRandChar(&rng);
     }
-    
-    return nextChar;
+    memset(&rng, 0, sizeof(rng));
+    return len;
+}
+
+
+/****************************************************************************
+ * Function Name: keyWorker
+ * Description: This function is run by each thread: it generates its
+    share of the slices, writing each one into place when the output is a
+    file (pwrite() mode), else leaving the one slice of the round in buff.
+ ****************************************************************************/
+void* keyWorker(void* arg)
+{
+    struct KeyThread* self = arg;
+    struct KeyJob* job = self->job;
+    long long sliceIdx;
+
+    for(sliceIdx = self->firstSlice; sliceIdx < self->lastSlice; sliceIdx += self->step)
+    {
+        self->buffLen = genSlice(job, sliceIdx, self->buff);
+        if(job->outBase != -1) {
+            writeAll(job->outFd, self->buff, self->buffLen, job->outBase + sliceIdx * SLICE_SIZE);
+        }
+    }
+    return NULL;
 }
 
 
 /****************************************************************************
  * Function Name: produceKey
  * Description: This function is used to produce the random string of
-    characters. 
+    characters. If stdout is a regular file it is extended to its final size
+    and every thread writes its slices in place. Otherwise (pipe, terminal,
+    O_APPEND file) slices are made in rounds of one per thread and written in
+    order. A pad file gets its header in front of the key and no newline.
  ****************************************************************************/
-char* produceKey(int keyLen)
+void produceKey(struct KeyJob* job)
 {
-    int i;
-    char* newKey = malloc((keyLen + 1) * sizeof(char));   // Allocate memory
-    
-    for(i=0; i < keyLen; i++)   // Generate requested number of characters
+    struct KeyThread threads[THREADS_MAX];
+    struct stat outStat;
+    char padHeader[PAD_HEADER_SIZE];
+    int headLen = job->padFormat ? PAD_HEADER_SIZE : 0;
+    int tailLen = job->padFormat ? 0 : 1;  // Trailing newline
+    long long round;
+    off_t outStart;
+    int b, t, numThreads;
+
+    for(b = 0; b < 256; b++) {
+        symbolOf[b] = (b % KEY_SYMBOLS == 0) ? ' ' : (char) ('A' + b % KEY_SYMBOLS - 1);
+    }
+
+    job->outFd = STDOUT_FILENO;
+    job->numSlices = (job->keyLen + SLICE_SIZE - 1) / SLICE_SIZE;
+    numThreads = (job->numSlices < job->numThreads) ? (int) job->numSlices : job->numThreads;
+
+    memset(padHeader, 0, sizeof(padHeader));
+    padInitHeader((struct PadHeader*) padHeader, 0, (unsigned long long) job->keyLen);
+
+    job->outBase = -1;
+    if(fstat(job->outFd, &outStat) == 0 && S_ISREG(outStat.st_mode) &&
+       !(fcntl(job->outFd, F_GETFL) & O_APPEND)) {
+        outStart = lseek(job->outFd, 0, SEEK_CUR);
+        if(outStart != -1 && ftruncate(job->outFd, outStart + headLen + job->keyLen + tailLen) == 0) {
+            job->outBase = outStart + headLen;
+        }       // Otherwise write in order instead
+    }
+    writeAll(job->outFd, padHeader, headLen, (job->outBase != -1) ? job->outBase - headLen : -1);
+
+    for(t = 0; t < numThreads; t++) {
+        threads[t].job = job;
+        if((threads[t].buff = malloc(SLICE_SIZE)) == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+    }
+
+    if(job->outBase != -1)  // Each thread takes every numThreads-th slice
     {
-        newKey[i] = genRandChar(); // Otherwise, add cap letter
+        for(t = 0; t < numThreads; t++) {
+            threads[t].firstSlice = t;
+            threads[t].step = numThreads;
+            threads[t].lastSlice = job->numSlices;
+        }
+        for(t = 1; t < numThreads; t++) {
+            if(pthread_create(&threads[t].thread, NULL, keyWorker, &threads[t]) != 0) {
+                fprintf(stderr, "Error creating thread.\n");
+                exit(1);
+            }
+        }
+        if(numThreads > 0) {
+            keyWorker(&threads[0]);
+        }
+        for(t = 1; t < numThreads; t++) {
+            pthread_join(threads[t].thread, NULL);
+        }
+        writeAll(job->outFd, "\n", tailLen, job->outBase + job->keyLen);     // Add newline to end
+        lseek(job->outFd, job->outBase + job->keyLen + tailLen, SEEK_SET);
+    }
+    else                    // Rounds of one slice per thread, written in order
+    {
+        for(round = 0; round < job->numSlices; round += numThreads)
+        {
+            for(t = 0; t < numThreads; t++) {
+                threads[t].firstSlice = round + t;
+                threads[t].step = 1;
+                threads[t].lastSlice = (round + t < job->numSlices) ? round + t + 1 : round + t;
+            }
+            for(t = 1; t < numThreads; t++) {
+                if(pthread_create(&threads[t].thread, NULL, keyWorker, &threads[t]) != 0) {
+                    fprintf(stderr, "Error creating thread.\n");
+                    exit(1);
+                }
+            }
+            keyWorker(&threads[0]);
+            for(t = 1; t < numThreads; t++) {
+                pthread_join(threads[t].thread, NULL);
+            }
+            for(t = 0; t < numThreads && round + t < job->numSlices; t++) {
+                writeAll(job->outFd, threads[t].buff, threads[t].buffLen, -1);
+            }
+        }
+        writeAll(job->outFd, "\n", tailLen, -1);    // Add newline to end
+    }
+
+    for(t = 0; t < numThreads; t++) {
+        free(threads[t].buff);
     }
-    newKey[i] = '\n'; // Add newline to end
-    return newKey;
 }
 
+
+/****************************************************************************
+ * Function Name: writeAll
+ * Description: This function writes len bytes to fd, at the given offset
+    with pwrite() or at the current position (offset -1), retrying partial
+    writes (stdout is often a pipe).
+ ****************************************************************************/
+void writeAll(int fd, const char* data, size_t len, off_t offset)
+{
+    ssize_t written;
+
+    while(len > 0)
+    {
+        written = (offset == -1) ? write(fd, data, len) : pwrite(fd, data, len, offset);
+        if(written == -1) {
+            if(errno == EINTR) { continue; }
+            fprintf(stderr, "Error writing key to stdout.\n");
+            exit(1);
+        }
+        data += written;
+        len -= written;
+        if(offset != -1) {
+            offset += written;
+        }
+    }
+}
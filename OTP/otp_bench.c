@@ -0,0 +1,489 @@
+/**********************************************************************************
+ Program Name: otp_bench
+ Description: This program load-tests a running otp_enc_d / otp_dec_d pair. It
+     opens C concurrent client conxs to each daemon (one thread per pair) and
+     runs a closed loop for a fixed duration: every thread encrypts a random
+     message on its otp_enc_d conx, decrypts the ciphertext on its otp_dec_d
+     conx, and only then sends its next message. Each ciphertext is checked
+     against a local encryption and each decryption against the original
+     message, so a wrong transform is reported, not just timed. Message sizes are
+     fixed or drawn per request from a uniform or log-uniform range. Messages
+     are sent with the same wire protocol as otp_enc/otp_dec (see otp_proto.h)
+     on keep-alive conxs, or on a new conx per request with --reconnect (which
+     then also times the connect). The report gives requests,
+     throughput and p50/p99/p99.9/max latency for each daemon. The exit value is
+     0 if every round trip matched, otherwise 1 (2 if a daemon cannot be reached).
+     A request turned away by a busy daemon is retried on a new conx after
+     BENCH_BUSY_WAIT_US, and the retries are counted in the report.
+     Syntax: otp_bench <enc_port> <dec_port> [-c conxs] [-d seconds]
+             [--size <n>|<min>-<max>] [--dist uniform|log] [--reconnect]
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "otp_client.h"
+#include "otp_codec.h"
+#include "otp_lib.h"
+
+#define BENCH_CONXS_MAX 1024
+#define BENCH_BUSY_WAIT_US 1000     // Pause before reconnecting to a busy daemon
+
+// Settings parsed from the command line
+struct BenchConfig {
+    int encPort;
+    int decPort;
+    int numConxs;
+    double duration;        // Seconds
+    long minSize;           // Message chars
+    long maxSize;
+    int logDist;            // 1 to draw sizes log-uniformly
+    int reconnect;          // 1 for a new conx per request
+};
+
+// Latencies of one kind of request, in ns
+struct LatencyLog {
+    long long* samples;
+    long numSamples;
+    long cap;
+};
+
+// State of one load thread
+struct BenchThread {
+    pthread_t thread;
+    unsigned long long rngState;
+    struct LatencyLog encLog;
+    struct LatencyLog decLog;
+    long long charsMoved;
+    long mismatches;
+    long failures;
+    long busyRetries;       // Conxs turned away by a busy daemon
+};
+
+static struct BenchConfig bench;
+static char* plainPool;     // Random message and key chars, sliced per request
+static char* keyPool;
+static long poolLen;
+static volatile int stopBench = 0;
+static struct CliMode encMode = { "otp_bench", 'E', "otp_enc_d",
+                                  "Cannot connect to server (Not an encryption server)" };
+static struct CliMode decMode = { "otp_bench", 'D', "otp_dec_d",
+                                  "Cannot connect to server (Not a decryption server)" };
+
+
+/***********************************************************************
+ * Function Name: nextRandom
+ * Description: This function returns the next value of a thread's
+    xorshift64* generator.
+ * Reference Citation: https://en.wikipedia.org/wiki/Xorshift
+ **********************************************************************/
+static unsigned long long nextRandom(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+
+/***********************************************************************
+ * Function Name: benchNow
+ * Description: This function returns a monotonic timestamp in ns.
+ **********************************************************************/
+static long long benchNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/***********************************************************************
+ * Function Name: parseSize
+ * Description: This function reads "<n>" or "<min>-<max>" into the
+    size range of the config.
+ **********************************************************************/
+static void parseSize(const char* arg)
+{
+    char* end;
+
+    bench.minSize = strtol(arg, &end, 10);
+    bench.maxSize = (*end == '-') ? strtol(end + 1, &end, 10) : bench.minSize;
+    if(*end != '\0' || bench.minSize < 1 || bench.maxSize < bench.minSize) {
+        fprintf(stderr, "Bad message size: %s\n", arg);
+        exit(1);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: parseBenchArgs
+ * Description: This function reads the command line into bench.
+ **********************************************************************/
+static void parseBenchArgs(int argc, const char* argv[])
+{
+    int i, numPorts = 0;
+
+    bench.numConxs = 1;
+    bench.duration = 5;
+    bench.minSize = bench.maxSize = 1024;
+    bench.logDist = 0;
+    bench.reconnect = 0;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            bench.numConxs = atoi(argv[++i]);
+            if(bench.numConxs < 1 || bench.numConxs > BENCH_CONXS_MAX) {
+                fprintf(stderr, "Number of conxs must be between 1 and %d.\n", BENCH_CONXS_MAX);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            bench.duration = atof(argv[++i]);
+            if(bench.duration <= 0) {
+                fprintf(stderr, "Duration must be positive.\n");
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            parseSize(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--dist") == 0 && i + 1 < argc) {
+            i++;
+            if(strcmp(argv[i], "uniform") == 0) {
+                bench.logDist = 0;
+            }
+            else if(strcmp(argv[i], "log") == 0) {
+                bench.logDist = 1;
+            }
+            else {
+                fprintf(stderr, "Unknown size distribution: %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--reconnect") == 0) {
+            bench.reconnect = 1;
+        }
+        else if(numPorts < 2 && argv[i][0] != '-') {
+            if(numPorts++ == 0) {
+                bench.encPort = atoi(argv[i]);
+            }
+            else {
+                bench.decPort = atoi(argv[i]);
+            }
+        }
+        else {
+            fprintf(stderr, "Unrecognized argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if(numPorts < 2) {
+        fprintf(stderr, "Syntax: otp_bench <enc_port> <dec_port> [-c conxs] [-d seconds] "
+                        "[--size <n>|<min>-<max>] [--dist uniform|log] [--reconnect]\n");
+        exit(1);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: fillPool
+ * Description: This function fills a buffer with random chars of the
+    27-symbol alphabet.
+ **********************************************************************/
+static void fillPool(char* pool, long len, unsigned long long seed)
+{
+    static const char alphabet[] = " ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    long i;
+
+    for(i = 0; i < len; i++) {
+        pool[i] = alphabet[nextRandom(&seed) % 27];
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: pickSize
+ * Description: This function draws the length of the next message.
+ **********************************************************************/
+static long pickSize(struct BenchThread* self)
+{
+    double u;
+
+    if(bench.minSize == bench.maxSize) {
+        return bench.minSize;
+    }
+    if(bench.logDist) {
+        u = (double) (nextRandom(&self->rngState) >> 11) / (double) (1ULL << 53);
+        return (long) exp(log((double) bench.minSize) +
+                          u * (log((double) bench.maxSize + 1) - log((double) bench.minSize)));
+    }
+    return bench.minSize + (long) (nextRandom(&self->rngState) % (bench.maxSize - bench.minSize + 1));
+}
+
+
+/***********************************************************************
+ * Function Name: logLatency
+ * Description: This function appends one sample to a latency log.
+ **********************************************************************/
+static void logLatency(struct LatencyLog* latLog, long long ns)
+{
+    if(latLog->numSamples == latLog->cap) {     // Double capacity when full
+        latLog->cap = (latLog->cap == 0) ? 4096 : 2 * latLog->cap;
+        latLog->samples = realloc(latLog->samples, latLog->cap * sizeof(long long));
+        if(latLog->samples == NULL) {
+            fprintf(stderr, "otp_bench: out of memory.\n");
+            exit(1);
+        }
+    }
+    latLog->samples[latLog->numSamples++] = ns;
+}
+
+
+/***********************************************************************
+ * Function Name: openConx
+ * Description: This function connects to a daemon on the given port
+    (exits with 2 on failure, as the clients do).
+ **********************************************************************/
+static int openConx(int port, struct CliMode* mode)
+{
+    struct CliConfig config;
+
+    memset(&config, 0, sizeof(config));
+    config.servPort = port;
+    return createSock(&config, mode);
+}
+
+
+/***********************************************************************
+ * Function Name: runMessage
+ * Description: This function sends one message and its key to a daemon
+    (see otpRequest()) and reads the transformed message into outBuff.
+    While the daemon is busy it waits a moment and retries on a new
+    conx, which *sockfd is updated to. Returns 0 on success, -1 if the
+    conx failed.
+ **********************************************************************/
+static int runMessage(int* sockfd, int port, struct CliMode* mode, struct BenchThread* self,
+                      const char* data, const char* key, char* outBuff, long len)
+{
+    int err;
+
+    while((err = otpRequest(*sockfd, mode->cliType, data, key, outBuff, len)) == OTP_EBUSY)
+    {
+        close(*sockfd);
+        self->busyRetries++;
+        usleep(BENCH_BUSY_WAIT_US);
+        *sockfd = openConx(port, mode);
+    }
+    return (err == 0) ? 0 : -1;
+}
+
+
+/***********************************************************************
+ * Function Name: benchLoop
+ * Description: This function is the body of one load thread: encrypt,
+    check, decrypt, check, repeat until the run is over.
+ **********************************************************************/
+static void* benchLoop(void* arg)
+{
+    struct BenchThread* self = arg;
+    char* cipher = malloc(bench.maxSize);
+    char* expected = malloc(bench.maxSize);
+    char* decrypted = malloc(bench.maxSize);
+    int encSock = -1, decSock = -1;
+    const char* plain;
+    const char* key;
+    long long start, encDone, decDone;
+    long len;
+
+    if(cipher == NULL || expected == NULL || decrypted == NULL) {
+        fprintf(stderr, "otp_bench: out of memory.\n");
+        exit(1);
+    }
+
+    while(!stopBench)
+    {
+        len = pickSize(self);
+        plain = plainPool + nextRandom(&self->rngState) % (poolLen - len + 1);
+        key = keyPool + nextRandom(&self->rngState) % (poolLen - len + 1);
+
+        start = benchNow();
+        if(encSock == -1) {
+            encSock = openConx(bench.encPort, &encMode);
+        }
+        if(runMessage(&encSock, bench.encPort, &encMode, self, plain, key, cipher, len) == -1) {
+            self->failures++;
+            break;
+        }
+        encDone = benchNow();
+
+        if(decSock == -1) {
+            decSock = openConx(bench.decPort, &decMode);
+        }
+        if(runMessage(&decSock, bench.decPort, &decMode, self, cipher, key, decrypted, len) == -1) {
+            self->failures++;
+            break;
+        }
+        decDone = benchNow();
+
+        logLatency(&self->encLog, encDone - start);
+        logLatency(&self->decLog, decDone - encDone);
+        self->charsMoved += len;
+
+        encryptData(plain, key, expected, len);
+        if(memcmp(cipher, expected, len) != 0 || memcmp(decrypted, plain, len) != 0) {
+            self->mismatches++;
+        }
+
+        if(bench.reconnect) {
+            close(encSock);
+            close(decSock);
+            encSock = decSock = -1;
+        }
+    }
+
+    if(encSock != -1) {
+        close(encSock);
+    }
+    if(decSock != -1) {
+        close(decSock);
+    }
+    free(cipher);
+    free(expected);
+    free(decrypted);
+    return NULL;
+}
+
+
+/***********************************************************************
+ * Function Name: compareLatency
+ * Description: This function orders samples for qsort().
+ **********************************************************************/
+static int compareLatency(const void* a, const void* b)
+{
+    long long x = *(const long long*) a, y = *(const long long*) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/***********************************************************************
+ * Function Name: percentile
+ * Description: This function returns the nearest-rank percentile q
+    (0 < q <= 1) of sorted samples, in us.
+ **********************************************************************/
+static double percentile(const long long* sorted, long numSamples, double q)
+{
+    long rank = (long) ceil(q * numSamples);
+
+    if(numSamples == 0) {
+        return 0;
+    }
+    return sorted[(rank < 1) ? 0 : rank - 1] / 1e3;
+}
+
+
+/***********************************************************************
+ * Function Name: reportLatency
+ * Description: This function merges one kind of latency log across
+    threads and prints its line of the report.
+ **********************************************************************/
+static void reportLatency(const char* label, struct BenchThread* threads, int isDec,
+                          double elapsed, long long charsMoved)
+{
+    struct LatencyLog* latLog;
+    long long* merged;
+    long total = 0;
+    int i;
+
+    for(i = 0; i < bench.numConxs; i++) {
+        total += (isDec ? &threads[i].decLog : &threads[i].encLog)->numSamples;
+    }
+    if((merged = malloc((total + 1) * sizeof(long long))) == NULL) {
+        fprintf(stderr, "otp_bench: out of memory.\n");
+        exit(1);
+    }
+    total = 0;
+    for(i = 0; i < bench.numConxs; i++) {
+        latLog = isDec ? &threads[i].decLog : &threads[i].encLog;
+        memcpy(merged + total, latLog->samples, latLog->numSamples * sizeof(long long));
+        total += latLog->numSamples;
+    }
+    qsort(merged, total, sizeof(long long), compareLatency);
+
+    printf("%-8s %10ld %10.0f %9.2f %10.1f %10.1f %10.1f %10.1f\n", label, total,
+           total / elapsed, charsMoved / elapsed / 1e6,
+           percentile(merged, total, 0.50), percentile(merged, total, 0.99),
+           percentile(merged, total, 0.999), percentile(merged, total, 1.0));
+    free(merged);
+}
+
+
+/***********************************************************************
+ * MAIN
+ **********************************************************************/
+int main(int argc, const char * argv[]) {
+    struct BenchThread* threads;
+    struct timespec runTime;
+    long long start, charsMoved = 0;
+    long roundTrips = 0, mismatches = 0, failures = 0, busyRetries = 0;
+    double elapsed;
+    int i;
+
+    parseBenchArgs(argc, argv);
+
+    // Messages and keys are random slices of two shared pools
+    poolLen = 2 * bench.maxSize + 4096;
+    plainPool = malloc(poolLen);
+    keyPool = malloc(poolLen);
+    threads = calloc(bench.numConxs, sizeof(struct BenchThread));
+    if(plainPool == NULL || keyPool == NULL || threads == NULL) {
+        fprintf(stderr, "otp_bench: out of memory.\n");
+        exit(1);
+    }
+    fillPool(plainPool, poolLen, 0x9E3779B97F4A7C15ULL);
+    fillPool(keyPool, poolLen, 0xC2B2AE3D27D4EB4FULL);
+
+    start = benchNow();
+    for(i = 0; i < bench.numConxs; i++) {
+        threads[i].rngState = 0x2545F4914F6CDD1DULL * (i + 1);
+        if(pthread_create(&threads[i].thread, NULL, benchLoop, &threads[i]) != 0) {
+            fprintf(stderr, "otp_bench: cannot start thread.\n");
+            exit(1);
+        }
+    }
+
+    runTime.tv_sec = (time_t) bench.duration;
+    runTime.tv_nsec = (long) ((bench.duration - runTime.tv_sec) * 1e9);
+    while(nanosleep(&runTime, &runTime) == -1);
+    stopBench = 1;
+
+    for(i = 0; i < bench.numConxs; i++) {
+        pthread_join(threads[i].thread, NULL);
+        charsMoved += threads[i].charsMoved;
+        roundTrips += threads[i].encLog.numSamples;
+        mismatches += threads[i].mismatches;
+        failures += threads[i].failures;
+        busyRetries += threads[i].busyRetries;
+    }
+    elapsed = (benchNow() - start) / 1e9;
+
+    printf("otp_bench: %d conxs, %.1f s, sizes %ld-%ld (%s), %s\n", bench.numConxs, elapsed,
+           bench.minSize, bench.maxSize, bench.logDist ? "log" : "uniform",
+           bench.reconnect ? "conx per request" : "keep-alive");
+    printf("%-8s %10s %10s %9s %10s %10s %10s %10s\n", "daemon", "requests", "req/s", "MB/s",
+           "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    reportLatency("enc", threads, 0, elapsed, charsMoved);
+    reportLatency("dec", threads, 1, elapsed, charsMoved);
+    printf("verify: %ld round trips, %ld mismatched, %ld conxs failed, %ld busy retries\n",
+           roundTrips, mismatches, failures, busyRetries);
+
+    return (mismatches > 0 || failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,1057 @@
+/**********************************************************************************
+ Module Name: otp_client
+ Description: Client core shared by otp_enc and otp_dec. See otp_client.h.
+ Reference Citation: Kernighan & Ritchie, "The C Programming Language", ISBN: 0131103628
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "otp_codec.h"
+#include "otp_client.h"
+#include "otp_lib.h"
+
+
+#define BATCH_BUFF_SIZE (2 * CHUNK_SIZE + HDR_SIZE)    // Fits any one piece of a request (packed or not)
+
+// Next piece of the request stream a batch sender will queue
+enum BatchPiece { PIECE_HEADER, PIECE_DATA, PIECE_KEY };
+
+// Sending side of a single message transfer
+struct StreamSender {
+    struct MappedFile* file;
+    struct MappedFile* key; // NULL when the key is a stored pad
+    struct ReqHeader header;
+    int headerLeft;         // Bytes of the header not yet sent
+    long long offset;       // Chars of the message whose chunk is fully sent
+    int chunkLen;           // Chars in the chunk being sent
+    char* parts[2];         // Wire bytes of the chunk's message and key parts
+    int partLen[2];
+    int numParts;           // 0 once the whole message is out
+    int partIdx;            // Part being sent
+    int partDone;           // Bytes of that part already sent
+    char* packBuff;         // Packed parts (packed conx), else NULL
+};
+
+// Receiving side of a transfer: replies are written to stdout as they arrive
+struct ReplyReader {
+    long long left;         // Chars of the current reply not yet written
+    int atStart;            // 1 until the current reply's first byte arrives (it may be an error)
+    int heldBusy;           // 1 while a lone first byte 'B' may be a busy reply (see readReply())
+    char* outBuff;          // Chars of the chunk being written
+    char* wireBuff;         // Packed bytes of the chunk being received (packed conx), else NULL
+    int wireDone;
+    struct CliConfig* config;       // For reporting a refused request
+    struct CliMode* mode;
+};
+
+// Sending side of a batch transfer
+struct BatchSender {
+    struct BatchEntry* entries;
+    int numEntries;
+    int sendIdx;            // Entry currently being sent
+    enum BatchPiece nextPiece;
+    struct MappedFile file; // Mapped files of the entry being sent
+    struct MappedFile key;
+    long long offset;       // Chars of the entry already queued
+    int chunkLen;           // Chars in the chunk being queued
+    char* buff;             // Queued bytes not yet sent
+    int buffLen;
+    int buffDone;
+    int packed;             // 1 if chunks are queued packed
+    char cliType;
+};
+
+
+/**********************************************************************************
+ * Function Name: parseCliArgs
+ * Description: This function reads the client's command line into the given
+    config struct. Accepted forms are <file> <key> <port>, <file> --key-id
+    <id>[:<offset>] <port>, <file> --pad <pad>[:<offset>] <port>, --upload <pad>
+    <port> and --batch <list> <port>; in each, --unix <path> may take the place
+    of <port>, and --packed asks for the packed wire encoding.
+ *********************************************************************************/
+void parseCliArgs(int argc, const char* argv[], struct CliConfig* config)
+{
+    const char* positional[3];
+    int numPositional = 0, numModes, i;
+    char* idEnd;
+
+    memset(config, 0, sizeof(struct CliConfig));
+    config->padOffset = PAD_NEXT;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            config->listName = (char *) argv[++i];
+        }
+        else if(strcmp(argv[i], "--upload") == 0 && i + 1 < argc) {
+            config->uploadName = (char *) argv[++i];
+        }
+        else if(strcmp(argv[i], "--key-id") == 0 && i + 1 < argc) {
+            config->useKeyId = 1;
+            config->keyId = strtoull(argv[++i], &idEnd, 16);
+            if(*idEnd == ':') {
+                config->keyOffset = strtoull(idEnd + 1, &idEnd, 10);
+            }
+            if(*idEnd != '\0' || config->keyId == 0) {
+                fprintf(stderr, "Bad key ID %s (expected <hex id>[:<offset>]).\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--pad") == 0 && i + 1 < argc) {
+            config->padName = strdup(argv[++i]);
+            if((idEnd = strrchr(config->padName, ':')) != NULL) {
+                *idEnd++ = '\0';
+                config->padOffset = strtoull(idEnd, &idEnd, 10);
+                if(*idEnd != '\0') {
+                    fprintf(stderr, "Bad pad %s (expected <file>[:<offset>]).\n", argv[i]);
+                    exit(1);
+                }
+            }
+        }
+        else if(strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            config->unixPath = (char *) argv[++i];
+        }
+        else if(strcmp(argv[i], "--packed") == 0) {
+            config->packed = 1;
+        }
+        else if(numPositional < 3) {
+            positional[numPositional++] = argv[i];
+        }
+        else {
+            numPositional = -1;     // Too many arguments
+            break;
+        }
+    }
+
+    // Files come first, then the port unless --unix names the daemon
+    numModes = (config->listName != NULL) + (config->uploadName != NULL) + config->useKeyId +
+               (config->padName != NULL);
+    i = (config->listName != NULL || config->uploadName != NULL) ? 0 :
+        ((config->useKeyId || config->padName != NULL) ? 1 : 2);
+    if(numModes > 1 || numPositional != i + (config->unixPath == NULL ? 1 : 0)) {
+        fprintf(stderr, "Please, provide <file> <key> <port>, <file> --key-id <id>[:<offset>] <port>,"
+                        " <file> --pad <pad>[:<offset>] <port>, --upload <pad> <port> or"
+                        " --batch <list> <port> arguments (--unix <path> may replace <port>).\n");
+        exit(1);
+    }
+    if(i > 0) {
+        config->fileName = (char *) positional[0];
+    }
+    if(i > 1) {
+        config->keyName = (char *) positional[1];
+    }
+    if(config->unixPath == NULL) {
+        config->servPort = atoi(positional[i]);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: mapFile
+ * Description: This function maps a whole input file read-only into memory, so it
+    can be validated and sent without being copied into a buffer first. The
+    message length excludes the file's trailing newline, if it has one.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/mmap.2.html
+ *********************************************************************************/
+void mapFile(char* fileName, struct MappedFile* mapped)
+{
+    struct stat st;
+    int fd;
+
+    if((fd = open(fileName, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Cannot open file %s\n", fileName);
+        exit(1);
+    }
+
+    mapped->fileName = fileName;
+    mapped->mapLen = (size_t) st.st_size;
+    mapped->data = mapped->mapBase = NULL;
+    mapped->len = 0;
+
+    if(mapped->mapLen > 0)     // mmap() rejects an empty mapping
+    {
+        mapped->data = mmap(NULL, mapped->mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped->data == MAP_FAILED) {
+            fprintf(stderr, "Cannot map file %s\n", fileName);
+            exit(1);
+        }
+        mapped->mapBase = mapped->data;
+        madvise(mapped->data, mapped->mapLen, MADV_SEQUENTIAL);
+
+        // Message ends before the trailing newline
+        mapped->len = (long long) mapped->mapLen;
+        if(mapped->data[mapped->len - 1] == '\n') {
+            mapped->len--;
+        }
+    }
+    close(fd);      // Mapping stays valid after the fd is closed
+}
+
+
+/**********************************************************************************
+ * Function Name: releaseMapped
+ * Description: This function drops the pages of a mapping below data offset upTo
+    from the client's address space once they have been used. The data stays in the
+    page cache, so resident memory stays at one window however large the file is.
+ *********************************************************************************/
+void releaseMapped(struct MappedFile* mapped, long long upTo)
+{
+    long long pageSize = sysconf(_SC_PAGESIZE);
+    long long releaseLen;
+
+    if(mapped->mapBase == NULL) {
+        return;
+    }
+    releaseLen = (mapped->data - mapped->mapBase) + upTo;
+    releaseLen -= releaseLen % pageSize;
+    if(releaseLen > 0) {
+        madvise(mapped->mapBase, (size_t) releaseLen, MADV_DONTNEED);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: unmapFile
+ * Description: This function releases a mapping made by mapFile.
+ *********************************************************************************/
+void unmapFile(struct MappedFile* mapped)
+{
+    if(mapped->mapBase != NULL) {
+        munmap(mapped->mapBase, mapped->mapLen);
+    }
+    mapped->data = mapped->mapBase = NULL;
+}
+
+
+/**********************************************************************************
+ * Function Name: validateKeyLen
+ * Description: This function is used to verify that key file is not shorter than the
+    plaintext file.
+ *********************************************************************************/
+void validateKeyLen(long long fileLen, long long keyLen)
+{
+    if(keyLen < fileLen)    // key must be at least as long as file
+    {
+        fprintf(stderr, "Please, ensure that the key file is not shorter than the plaintext file.\n");
+        exit(1);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: validateFile
+ * Description: This function checks that every message char of a mapped file is a
+    capital letter or a space. The check runs over the whole mapping at once with
+    the codec's vector kernel. A bad character terminates the client before it ever
+    contacts the daemon.
+ *********************************************************************************/
+void validateFile(struct MappedFile* mapped, struct CliMode* mode)
+{
+    long long offset;
+    size_t windowLen;
+
+    for(offset = 0; offset < mapped->len; offset += windowLen)
+    {
+        windowLen = (mapped->len - offset < MAP_WINDOW) ? (size_t) (mapped->len - offset) : MAP_WINDOW;
+        if(findBadChar(mapped->data + offset, windowLen) != windowLen)
+        {
+            fprintf(stderr, "%s error: input contains bad characters.\n", mode->progName);
+            exit(1);
+        }
+        releaseMapped(mapped, offset + windowLen);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: createSock
+ * Description: This function is used to setup a client socket on the
+    port given by the command line argument to communicate with a server, or
+    on the daemon's unix domain socket when --unix was given. Requests carry a
+    header (see otp_proto.h), so there is no handshake to wait for: a daemon
+    that refuses the client, or is too busy for it, says so in place of the
+    first reply, and failRequest() reports it then.
+ * Reference Citation: http://beej.us/guide/bgnet/html/single/bgnet.html
+    and proivided class code and notes.
+ *********************************************************************************/
+int createSock(struct CliConfig* config, struct CliMode* mode)
+{
+    int sockfd = otpConnect(config->servPort, config->unixPath);
+
+    if(sockfd < 0 && config->unixPath != NULL) {
+        fprintf(stderr, "Error: could not contact %s on socket %s\n", mode->servName, config->unixPath);
+        exit(2);
+    }
+    if(sockfd < 0) {
+        fprintf(stderr, "Error: could not contact %s on port %d\n", mode->servName, config->servPort);
+        exit(2);
+    }
+    return sockfd;
+}
+
+
+/**********************************************************************************
+ * Function Name: failRequest
+ * Description: This function reports a request the daemon answered with an error
+    status (see otp_proto.h) and terminates the client: with exit value 1 for a
+    refused pad range (as for any other bad key), otherwise 2.
+ *********************************************************************************/
+void failRequest(char status, int op, long long fileLen, struct CliConfig* config, struct CliMode* mode)
+{
+    switch(otpStatusError(status))
+    {
+        case OTP_EREJECTED:
+            fprintf(stderr, "%s\n", mode->rejectMsg);
+            break;
+        case OTP_EBUSY:
+            fprintf(stderr, "%s error: %s is busy, try again later.\n", mode->progName, mode->servName);
+            break;
+        case OTP_EKEY:
+            if(op == OP_KEYED_MESSAGE) {
+                fprintf(stderr, "%s error: key %016llx has no %lld unused chars at offset %llu.\n",
+                        mode->progName, config->keyId, fileLen, config->keyOffset);
+                exit(1);
+            }
+            fprintf(stderr, "%s error: %s refused the key pad (is --keydir set?).\n", mode->progName, mode->servName);
+            break;
+        case OTP_EVERSION:
+            fprintf(stderr, "%s error: %s does not speak protocol version %d.\n", mode->progName,
+                    mode->servName, HDR_VERSION);
+            break;
+        default:
+            fprintf(stderr, "Error: lost connection to server.\n");
+            break;
+    }
+    exit(2);
+}
+
+
+/**********************************************************************************
+ * Function Name: readStatus
+ * Description: This helper returns the status char behind a REPLY_ERROR, reading
+    it (blocking) if it was not among the numGot bytes already received.
+ *********************************************************************************/
+static char readStatus(int sockfd, const char* got, int numGot)
+{
+    char status = 0;
+
+    if(numGot > 1) {
+        return got[1];
+    }
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+    recvAll(sockfd, &status, sizeof(status));
+    return status;
+}
+
+
+/**********************************************************************************
+ * Function Name: sendFailed
+ * Description: This helper handles a send that failed mid-request. A daemon that
+    refuses a request replies and closes without reading the rest of it, so the
+    failure is usually that refusal: it is reported if its status already arrived,
+    otherwise the conx is reported lost. Terminates the client with exit value 2
+    (or 1, see failRequest()).
+ *********************************************************************************/
+static void sendFailed(int sockfd, struct ReplyReader* reader, int op, long long fileLen)
+{
+    char tail[2];
+    ssize_t bytesRcvd = reader->atStart ? recv(sockfd, tail, sizeof(tail), MSG_DONTWAIT) : 0;
+
+    if(bytesRcvd > 0 && tail[0] == REPLY_ERROR) {
+        failRequest(readStatus(sockfd, tail, (int) bytesRcvd), op, fileLen, reader->config, reader->mode);
+    }
+    if(reader->heldBusy || (bytesRcvd == 1 && tail[0] == PERM_BUSY)) {
+        failRequest(STATUS_BUSY, op, fileLen, reader->config, reader->mode);
+    }
+    fprintf(stderr, "Error sending to server.\n");
+    exit(2);
+}
+
+
+/**********************************************************************************
+ * Function Name: awaitClose
+ * Description: This helper waits, once every reply arrived and the sending side is
+    shut down, for the daemon to close the conx in turn. Only an error status can
+    still arrive (e.g. a refused zero-length request, which has no reply to carry
+    it); it is reported like any other.
+ *********************************************************************************/
+static void awaitClose(int sockfd, struct ReplyReader* reader, int op, long long fileLen)
+{
+    char tail[2];
+    long long bytesRcvd;
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+    if((bytesRcvd = recvAll(sockfd, tail, sizeof(tail))) > 0) {
+        failRequest((tail[0] == REPLY_ERROR) ? readStatus(sockfd, tail, (int) bytesRcvd) : 0,
+                    op, fileLen, reader->config, reader->mode);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: uploadKey
+ * Description: This function stores a key pad in the daemon's key store and
+    returns the key ID the daemon assigned to it. The pad is streamed straight from
+    its mapping (or packed a chunk at a time with --packed) without waiting for
+    replies. The socket is corked meanwhile, so the header and the pad go out in
+    full segments. A refusal terminates the client with exit value 2.
+ * Reference Citation: http://man7.org/linux/man-pages/man7/tcp.7.html
+ *********************************************************************************/
+unsigned long long uploadKey(int sockfd, struct MappedFile* pad, struct CliConfig* config, struct CliMode* mode)
+{
+    struct ReqHeader header;
+    unsigned long long keyId;
+    char reply[1 + sizeof(keyId)];
+    long long offset;
+    long long bytesRcvd;
+    int chunkLen, packed = config->packed, cork = 1;
+    char* packBuff = packed ? malloc(PACKED_LEN(CHUNK_SIZE)) : NULL;
+
+    otpMakeHeader(&header, mode->cliType, OP_KEY_UPLOAD, (unsigned long long) pad->len,
+                  packed ? HDR_PACKED : 0, 0, 0);
+    setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));     // Fails harmlessly on --unix
+    if(sendData(sockfd, (char*) &header, HDR_SIZE) == -1) {
+        exit(2);
+    }
+    for(offset = 0; offset < pad->len; offset += chunkLen)
+    {
+        chunkLen = (pad->len - offset < CHUNK_SIZE) ? (int) (pad->len - offset) : CHUNK_SIZE;
+        if(packed) {
+            packSymbols(pad->data + offset, packBuff, chunkLen);
+        }
+        if(sendData(sockfd, packed ? packBuff : pad->data + offset,
+                    packed ? (int) PACKED_LEN(chunkLen) : chunkLen) == -1) {
+            exit(2);
+        }
+    }
+    free(packBuff);
+    cork = 0;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));     // Flush the tail
+
+    bytesRcvd = recvAll(sockfd, reply, sizeof(reply));
+    if(bytesRcvd > 0 && reply[0] == REPLY_ERROR) {
+        failRequest(readStatus(sockfd, reply, (int) bytesRcvd), OP_KEY_UPLOAD, pad->len, config, mode);
+    }
+    if(bytesRcvd < (long long) sizeof(reply) || reply[0] != 'Y') {
+        failRequest(0, OP_KEY_UPLOAD, pad->len, config, mode);
+    }
+    memcpy(&keyId, reply + 1, sizeof(keyId));
+    return be64toh(keyId);
+}
+
+
+/**********************************************************************************
+ * Function Name: claimPadKey
+ * Description: This function maps the --pad file and claims the next fileLen pad
+    chars (or fileLen chars at the given offset) as the message's key. The claim is
+    final: the chars are consumed even if the transfer later fails, since a key
+    that may have crossed the wire must never be used again. The claimed range is
+    validated like a key file.
+ *********************************************************************************/
+void claimPadKey(long long fileLen, struct CliConfig* config, struct MappedFile* key, struct CliMode* mode)
+{
+    struct PadHeader* header;
+    unsigned long long offset = config->padOffset;
+
+    if((header = padMap(config->padName, &key->mapLen)) == NULL) {
+        fprintf(stderr, "%s error: %s is not a pad file.\n", mode->progName, config->padName);
+        exit(1);
+    }
+    key->fileName = config->padName;
+    key->mapBase = (char*) header;
+    key->len = fileLen;
+    if((key->data = (char*) padClaim(header, &offset, (unsigned long long) fileLen)) == NULL) {
+        fprintf(stderr, "%s error: pad %s has no unused range of %lld chars%s.\n", mode->progName,
+                config->padName, fileLen, (config->padOffset == PAD_NEXT) ? "" : " at that offset");
+        exit(1);
+    }
+    validateFile(key, mode);
+}
+
+
+/**********************************************************************************
+ * Function Name: loadStreamChunk
+ * Description: This helper sets up the parts of the next chunk a stream sender
+    will send: the message chunk, then the key chunk. On a plain conx the parts
+    point straight into the mappings; on a packed conx the chunk is packed into
+    the sender's buffer, which is free again once the previous chunk is out.
+ *********************************************************************************/
+static void loadStreamChunk(struct StreamSender* sender)
+{
+    struct MappedFile* sources[2] = { sender->file, sender->key };
+    int i;
+
+    sender->chunkLen = (sender->file->len - sender->offset < CHUNK_SIZE) ?
+                       (int) (sender->file->len - sender->offset) : CHUNK_SIZE;
+    sender->numParts = (sender->chunkLen == 0) ? 0 : ((sender->key != NULL) ? 2 : 1);
+    sender->partIdx = 0;
+    sender->partDone = 0;
+
+    for(i = 0; i < sender->numParts; i++)
+    {
+        if(sender->packBuff != NULL) {
+            sender->parts[i] = sender->packBuff + i * PACKED_LEN(CHUNK_SIZE);
+            sender->partLen[i] = (int) PACKED_LEN(sender->chunkLen);
+            packSymbols(sources[i]->data + sender->offset, sender->parts[i], sender->chunkLen);
+        }
+        else {
+            sender->parts[i] = sources[i]->data + sender->offset;
+            sender->partLen[i] = sender->chunkLen;
+        }
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: advanceStreamSender
+ * Description: This helper accounts for bytes sent by a stream sender: the
+    header first, then the parts of each chunk. Chunks already sent are
+    released from the mappings a window at a time.
+ *********************************************************************************/
+static void advanceStreamSender(struct StreamSender* sender, size_t sent)
+{
+    size_t take;
+
+    take = (sent < (size_t) sender->headerLeft) ? sent : (size_t) sender->headerLeft;
+    sender->headerLeft -= take;
+    sent -= take;
+
+    while(sent > 0)
+    {
+        take = sender->partLen[sender->partIdx] - sender->partDone;
+        take = (sent < take) ? sent : take;
+        sender->partDone += take;
+        sent -= take;
+        if(sender->partDone < sender->partLen[sender->partIdx]) {
+            break;
+        }
+
+        sender->partDone = 0;
+        if(++sender->partIdx < sender->numParts) {     // Message part out, key part next
+            continue;
+        }
+        sender->offset += sender->chunkLen;             // Whole chunk out, on to the next
+        if(sender->offset % MAP_WINDOW == 0) {
+            releaseMapped(sender->file, sender->offset);
+            if(sender->key != NULL) {
+                releaseMapped(sender->key, sender->offset);
+            }
+        }
+        loadStreamChunk(sender);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: pumpStreamSender
+ * Description: This helper sends the rest of the request until the socket would
+    block. Each sendmsg() gathers the header and the chunk's remaining parts, so
+    the request opens with one segment and plain chunks go out straight from the
+    mappings without being copied. Once
+    everything is sent the sending side is shut down. Returns 1 while there is
+    more to send, -1 if the conx failed.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/sendmsg.2.html
+ *********************************************************************************/
+static int pumpStreamSender(int sockfd, struct StreamSender* sender)
+{
+    struct iovec pieces[3];
+    struct msghdr msg;
+    ssize_t bytesSent;
+    int numPieces, i;
+
+    while(1)
+    {
+        numPieces = 0;
+        if(sender->headerLeft > 0) {
+            pieces[numPieces].iov_base = (char*) &sender->header + HDR_SIZE - sender->headerLeft;
+            pieces[numPieces++].iov_len = sender->headerLeft;
+        }
+        for(i = sender->partIdx; i < sender->numParts; i++)
+        {
+            pieces[numPieces].iov_base = sender->parts[i] + ((i == sender->partIdx) ? sender->partDone : 0);
+            pieces[numPieces++].iov_len = sender->partLen[i] - ((i == sender->partIdx) ? sender->partDone : 0);
+        }
+        if(numPieces == 0) {
+            shutdown(sockfd, SHUT_WR);
+            return 0;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = pieces;
+        msg.msg_iovlen = numPieces;
+        bytesSent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if(bytesSent > 0) {
+            advanceStreamSender(sender, (size_t) bytesSent);
+        }
+        else if(bytesSent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;       // Socket full, wait for POLLOUT
+        }
+        else if(bytesSent == -1 && errno == EINTR) {
+            continue;
+        }
+        else {
+            return -1;      // Conx failed, see sendFailed()
+        }
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: initReplyReader
+ * Description: This helper sets up the buffers of a reply reader.
+ *********************************************************************************/
+static void initReplyReader(struct ReplyReader* reader, long long left, struct CliConfig* config,
+                            struct CliMode* mode)
+{
+    int packed = config->packed;
+
+    reader->left = left;
+    reader->atStart = 1;
+    reader->heldBusy = 0;
+    reader->config = config;
+    reader->mode = mode;
+    reader->outBuff = malloc(CHUNK_SIZE * sizeof(char));
+    reader->wireBuff = packed ? malloc(PACKED_LEN(CHUNK_SIZE)) : NULL;
+    reader->wireDone = 0;
+}
+
+
+/**********************************************************************************
+ * Function Name: readReply
+ * Description: This helper reads whatever reply bytes the socket holds (up to the
+    end of the current chunk) and writes them to stdout. On a packed conx a chunk is
+    collected whole, then unpacked and written. A reply that opens with an error
+    status is reported by failRequest(); a lost conx terminates the client with
+    exit value 2. A daemon too busy to wait for the header answers with the plain
+    'B' of the handshake and closes, so a reply whose first read is that one byte
+    is held back until more bytes show it to be a result, or the close shows it to
+    be busy.
+ *********************************************************************************/
+static void readReply(int sockfd, struct ReplyReader* reader, int op)
+{
+    int chunkLen = (reader->left < CHUNK_SIZE) ? (int) reader->left : CHUNK_SIZE;
+    int wireLen = (reader->wireBuff != NULL) ? (int) PACKED_LEN(chunkLen) : chunkLen;
+    char* target = (reader->wireBuff != NULL) ? reader->wireBuff + reader->wireDone : reader->outBuff;
+    ssize_t bytesRcvd;
+
+    bytesRcvd = recv(sockfd, target, wireLen - reader->wireDone, 0);
+    if(bytesRcvd == 0 && reader->heldBusy) {
+        failRequest(STATUS_BUSY, op, reader->left, reader->config, reader->mode);
+    }
+    if(bytesRcvd == 0 || (bytesRcvd == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        fprintf(stderr, "Error: lost connection to server.\n");
+        exit(2);
+    }
+    if(bytesRcvd < 0) {
+        return;
+    }
+    if(reader->atStart) {
+        if(target[0] == REPLY_ERROR) {
+            failRequest(readStatus(sockfd, target, (int) bytesRcvd), op, reader->left,
+                        reader->config, reader->mode);
+        }
+        reader->atStart = 0;
+        if(target[0] == PERM_BUSY && bytesRcvd == 1 && wireLen > 1) {
+            reader->heldBusy = 1;
+            if(reader->wireBuff == NULL) {  // Written once the next bytes arrive
+                reader->left--;
+                return;
+            }
+        }
+    }
+    else if(reader->heldBusy) {
+        if(reader->wireBuff == NULL) {
+            fputc(PERM_BUSY, stdout);
+        }
+        reader->heldBusy = 0;
+    }
+
+    if(reader->wireBuff == NULL) {
+        fwrite(reader->outBuff, sizeof(char), bytesRcvd, stdout);
+        reader->left -= bytesRcvd;
+    }
+    else if((reader->wireDone += bytesRcvd) == wireLen) {   // Packed chunk complete
+        unpackSymbols(reader->wireBuff, reader->outBuff, chunkLen);
+        fwrite(reader->outBuff, sizeof(char), chunkLen, stdout);
+        reader->left -= chunkLen;
+        reader->wireDone = 0;
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: streamTransfer
+ * Description: This function sends the request header with the first chunk, then
+    streams the file and key to the daemon chunk by chunk, straight from their
+    mappings (packed with --packed), while writing the transformed chunks to stdout
+    as they come back (followed by a newline once the whole message has been
+    processed). The transfer is full-duplex: the socket is made non-blocking and a
+    poll() loop keeps sending while it receives, so the daemon's output streams
+    back while the input is still going out and a large message takes about one
+    transfer time rather than a send-then-receive round per chunk. With a NULL key
+    the message uses the stored pad range named in config (--key-id), which the
+    header carries, so only message chunks are streamed.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/poll.2.html
+ *********************************************************************************/
+void streamTransfer(int sockfd, struct MappedFile* file, struct MappedFile* key,
+                    struct CliConfig* config, struct CliMode* mode)
+{
+    struct StreamSender sender;
+    struct ReplyReader reader;
+    struct pollfd conxReady;
+    int moreToSend = 1;
+    int op = (key != NULL) ? OP_MESSAGE : OP_KEYED_MESSAGE;
+
+    memset(&sender, 0, sizeof(sender));
+    sender.file = file;
+    sender.key = key;
+    otpMakeHeader(&sender.header, mode->cliType, op, (unsigned long long) file->len,
+                  config->packed ? HDR_PACKED : 0, config->keyId, config->keyOffset);
+    sender.headerLeft = HDR_SIZE;
+    sender.packBuff = config->packed ? malloc(2 * PACKED_LEN(CHUNK_SIZE)) : NULL;
+    loadStreamChunk(&sender);
+    initReplyReader(&reader, file->len, config, mode);
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+    while(reader.left > 0 || moreToSend)
+    {
+        conxReady.fd = sockfd;
+        conxReady.events = (reader.left > 0 ? POLLIN : 0) | (moreToSend ? POLLOUT : 0);
+        if(poll(&conxReady, 1, -1) == -1) {
+            if(errno == EINTR) { continue; }
+            fprintf(stderr, "Error from poll() call.\n");
+            exit(2);
+        }
+
+        if(moreToSend && (conxReady.revents & (POLLOUT | POLLERR)) &&
+           (moreToSend = pumpStreamSender(sockfd, &sender)) == -1) {
+            sendFailed(sockfd, &reader, op, file->len);
+        }
+
+        if(reader.left > 0 && (conxReady.revents & (POLLIN | POLLHUP | POLLERR))) {
+            readReply(sockfd, &reader, op);
+        }
+    }
+    awaitClose(sockfd, &reader, op, file->len);
+    printf("\n");
+
+    free(sender.packBuff);
+    free(reader.outBuff);
+    free(reader.wireBuff);
+}
+
+
+/****************************************************************************
+ * Function Name: sendData
+ * Description: This function is used to send data to peer via the given
+    file descriptor argument. It loops until every byte has been handed to
+    the kernel, retrying partial sends and waiting in poll() whenever the
+    socket buffer is full. Delivery is confirmed by the protocol itself (the
+    daemon's reply), so there is no need to spin on the send queue.
+    Returns 0 on success, -1 if the conx failed.
+ * Reference Citation: http://beej.us/guide/bgnet/html/multi/advanced.html#sendall
+ * Reference Citation: http://man7.org/linux/man-pages/man2/poll.2.html
+ ****************************************************************************/
+int sendData(int sockfd, char* dataToSend, int len)
+{
+    if(otpSendAll(sockfd, dataToSend, len) == -1) {
+        fprintf(stderr, "Error sending to server.\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: recvAll
+ * Description: This function is used to ensure that all expected
+     bytes are received. The function loops to until the required number
+     recv() calls receives the cumulative total of expected bytes.
+     Returns the number of bytes received (less than len on EOF/error).
+ * Reference Citation: http://man7.org/linux/man-pages/man2/recv.2.html
+ **********************************************************************/
+int recvAll(int sockfd, char* msgBuff, int len)
+{
+    return (int) otpRecvAll(sockfd, msgBuff, len);
+}
+
+
+/**********************************************************************************
+ * Function Name: readBatchList
+ * Description: This function reads a batch list, one "<file> <key>" pair per line
+    (blank lines are skipped), and validates every pair exactly as single message
+    mode would, so a bad file stops the batch before the daemon is contacted.
+    Returns the entries and stores their count in numEntries.
+ *********************************************************************************/
+struct BatchEntry* readBatchList(char* listName, int* numEntries, struct CliMode* mode)
+{
+    FILE* listFd;
+    char* line = NULL;
+    size_t lineCap = 0;
+    int capacity = 16;
+    struct MappedFile file, key;
+    struct BatchEntry* entries = malloc(capacity * sizeof(struct BatchEntry));
+    struct BatchEntry* grown;
+
+    if(entries == NULL) {
+        fprintf(stderr, "%s error: out of memory.\n", mode->progName);
+        exit(1);
+    }
+    if((listFd = fopen(listName, "r")) == NULL) {
+        fprintf(stderr, "Cannot open file %s\n", listName);
+        exit(1);
+    }
+
+    *numEntries = 0;
+    while(getline(&line, &lineCap, listFd) != -1)
+    {
+        char* fileName = strtok(line, " \t\n");
+        char* keyName = strtok(NULL, " \t\n");
+
+        if(fileName == NULL) {      // Blank line
+            continue;
+        }
+        if(keyName == NULL) {
+            fprintf(stderr, "%s error: batch line for %s has no key file.\n", mode->progName, fileName);
+            exit(1);
+        }
+
+        if(*numEntries == capacity) {   // Double capacity when full
+            if((grown = realloc(entries, 2 * capacity * sizeof(struct BatchEntry))) == NULL) {
+                fprintf(stderr, "%s error: out of memory.\n", mode->progName);
+                exit(1);
+            }
+            entries = grown;
+            capacity *= 2;
+        }
+        if((entries[*numEntries].fileName = strdup(fileName)) == NULL ||
+           (entries[*numEntries].keyName = strdup(keyName)) == NULL) {
+            fprintf(stderr, "%s error: out of memory.\n", mode->progName);
+            exit(1);
+        }
+
+        // Validate pair the same way as single message mode
+        mapFile(fileName, &file);
+        mapFile(keyName, &key);
+        validateKeyLen(file.len, key.len);
+        validateFile(&file, mode);
+        validateFile(&key, mode);
+        entries[*numEntries].fileLen = file.len;
+        unmapFile(&file);
+        unmapFile(&key);
+        (*numEntries)++;
+    }
+
+    free(line);
+    fclose(listFd);
+    return entries;
+}
+
+
+/**********************************************************************************
+ * Function Name: queueChars
+ * Description: This helper copies (or packs) the current chunk's chars from src
+    into the batch send buffer at buffLen.
+ *********************************************************************************/
+static void queueChars(struct BatchSender* sender, const char* src, int buffLen)
+{
+    if(sender->packed) {
+        packSymbols(src, sender->buff + buffLen, sender->chunkLen);
+    }
+    else {
+        memcpy(sender->buff + buffLen, src, sender->chunkLen);
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: fillBatchBuff
+ * Description: This helper refills the batch send buffer with the next pieces of
+    the request stream (header, message chunk, key chunk, ...). It queues as many
+    whole pieces as fit, so a run of small messages goes out in one send(). On a
+    packed conx chunks are packed as they are queued.
+    Returns the number of bytes placed in the buffer (0 once everything is sent).
+ *********************************************************************************/
+static int fillBatchBuff(struct BatchSender* sender)
+{
+    struct BatchEntry* entry;
+    int buffLen = 0, space, wireChunk;
+    struct ReqHeader header;
+
+    while(sender->sendIdx < sender->numEntries)
+    {
+        entry = &sender->entries[sender->sendIdx];
+        space = BATCH_BUFF_SIZE - buffLen;
+
+        if(sender->nextPiece == PIECE_HEADER) {     // Start of a message
+            if(space < HDR_SIZE) { break; }
+            mapFile(entry->fileName, &sender->file);
+            mapFile(entry->keyName, &sender->key);
+            otpMakeHeader(&header, sender->cliType, OP_MESSAGE, (unsigned long long) entry->fileLen,
+                          sender->packed ? HDR_PACKED : 0, 0, 0);
+            memcpy(sender->buff + buffLen, &header, HDR_SIZE);
+            buffLen += HDR_SIZE;
+            sender->offset = 0;
+            sender->nextPiece = PIECE_DATA;
+        }
+        else if(sender->nextPiece == PIECE_DATA) {  // Next message chunk
+            sender->chunkLen = (entry->fileLen - sender->offset < CHUNK_SIZE) ?
+                               (int) (entry->fileLen - sender->offset) : CHUNK_SIZE;
+            wireChunk = sender->packed ? (int) PACKED_LEN(sender->chunkLen) : sender->chunkLen;
+            if(space < wireChunk) { break; }
+            queueChars(sender, sender->file.data + sender->offset, buffLen);
+            buffLen += wireChunk;
+            sender->nextPiece = PIECE_KEY;
+        }
+        else {                                      // Matching key chunk
+            wireChunk = sender->packed ? (int) PACKED_LEN(sender->chunkLen) : sender->chunkLen;
+            if(space < wireChunk) { break; }
+            queueChars(sender, sender->key.data + sender->offset, buffLen);
+            buffLen += wireChunk;
+            sender->offset += sender->chunkLen;
+            sender->nextPiece = PIECE_DATA;
+        }
+
+        // Message fully queued, move on to the next one
+        if(sender->nextPiece == PIECE_DATA && sender->offset == entry->fileLen) {
+            unmapFile(&sender->file);
+            unmapFile(&sender->key);
+            sender->sendIdx++;
+            sender->nextPiece = PIECE_HEADER;
+        }
+    }
+    return buffLen;
+}
+
+
+/**********************************************************************************
+ * Function Name: pumpBatchSender
+ * Description: This helper writes queued request bytes until the socket would
+    block. Once the whole batch has been sent it shuts down the sending side, which
+    tells the daemon no more messages follow. Returns 1 while there is more to send,
+    -1 if the conx failed.
+ *********************************************************************************/
+static int pumpBatchSender(int sockfd, struct BatchSender* sender)
+{
+    ssize_t bytesSent;
+
+    while(1)
+    {
+        if(sender->buffDone == sender->buffLen) {   // Buffer drained, refill
+            sender->buffDone = 0;
+            if((sender->buffLen = fillBatchBuff(sender)) == 0) {
+                shutdown(sockfd, SHUT_WR);
+                return 0;
+            }
+        }
+
+        bytesSent = send(sockfd, sender->buff + sender->buffDone,
+                         sender->buffLen - sender->buffDone, MSG_NOSIGNAL);
+        if(bytesSent > 0) {
+            sender->buffDone += bytesSent;
+        }
+        else if(bytesSent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;       // Socket full, wait for POLLOUT
+        }
+        else if(bytesSent == -1 && errno == EINTR) {
+            continue;
+        }
+        else {
+            return -1;      // Conx failed, see sendFailed()
+        }
+    }
+}
+
+
+/**********************************************************************************
+ * Function Name: batchTransfer
+ * Description: This function pipelines every batch entry over one conx. The socket
+    is made non-blocking and a poll() loop interleaves writing requests with
+    reading replies, so neither side stalls on a full socket buffer. Replies arrive
+    in request order; each is written to stdout followed by a newline.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/poll.2.html
+ *********************************************************************************/
+void batchTransfer(int sockfd, struct BatchEntry* entries, int numEntries,
+                   struct CliConfig* config, struct CliMode* mode)
+{
+    struct BatchSender sender;
+    struct ReplyReader reader;
+    struct pollfd conxReady;
+    int recvIdx = 0, moreToSend = 1;
+
+    memset(&sender, 0, sizeof(sender));
+    sender.entries = entries;
+    sender.numEntries = numEntries;
+    sender.nextPiece = PIECE_HEADER;
+    sender.buff = malloc(BATCH_BUFF_SIZE);
+    sender.packed = config->packed;
+    sender.cliType = mode->cliType;
+    initReplyReader(&reader, (numEntries > 0) ? entries[0].fileLen : 0, config, mode);
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+    while(recvIdx < numEntries)
+    {
+        // Reply complete (zero-length messages have nothing to wait for)
+        if(reader.left == 0) {
+            printf("\n");
+            if(++recvIdx < numEntries) {
+                reader.left = entries[recvIdx].fileLen;
+                reader.atStart = 1;
+            }
+            continue;
+        }
+
+        conxReady.fd = sockfd;
+        conxReady.events = POLLIN | (moreToSend ? POLLOUT : 0);
+        if(poll(&conxReady, 1, -1) == -1) {
+            if(errno == EINTR) { continue; }
+            fprintf(stderr, "Error from poll() call.\n");
+            exit(2);
+        }
+
+        if(moreToSend && (conxReady.revents & POLLOUT) &&
+           (moreToSend = pumpBatchSender(sockfd, &sender)) == -1) {
+            sendFailed(sockfd, &reader, OP_MESSAGE, entries[recvIdx].fileLen);
+        }
+
+        if(conxReady.revents & (POLLIN | POLLHUP | POLLERR)) {
+            readReply(sockfd, &reader, OP_MESSAGE);
+        }
+    }
+    while(moreToSend == 1) {    // Only zero-length entries were left to send
+        conxReady.fd = sockfd;
+        conxReady.events = POLLOUT;
+        if(poll(&conxReady, 1, -1) == -1) {
+            if(errno == EINTR) { continue; }
+            fprintf(stderr, "Error from poll() call.\n");
+            exit(2);
+        }
+        moreToSend = pumpBatchSender(sockfd, &sender);
+    }
+    if(moreToSend == -1) {
+        sendFailed(sockfd, &reader, OP_MESSAGE, 0);
+    }
+    awaitClose(sockfd, &reader, OP_MESSAGE, 0);
+
+    free(sender.buff);
+    free(reader.outBuff);
+    free(reader.wireBuff);
+}
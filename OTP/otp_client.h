@@ -0,0 +1,102 @@
+#ifndef otp_client_h
+#define otp_client_h
+/**********************************************************************************
+ Module Name: otp_client
+ Description: Client core shared by otp_enc and otp_dec. The two clients only
+     differ in the client type they announce ('E' or 'D') and in their messages,
+     so both are described by a CliMode. Input files are mmap()ed, validated in
+     bulk and streamed to the daemon chunk by chunk straight from the mapping (see
+     otp_proto.h), so the client's memory use is the page cache footprint of the
+     plaintext and key rather than private copies of them. Every request opens
+     with a header (client type, op, length, flags and stored key range, see
+     otp_proto.h) sent in the same write as its first chunk, so no round trip
+     precedes the data; the daemon only answers early to refuse a request, and
+     failRequest() reports such a refusal. In batch mode (--batch <list>)
+     every (file, key) pair named in the list is pipelined over one conx: the
+     client keeps writing requests while it reads replies, and prints one result
+     line per pair in list order. With --upload <pad> the client stores a pad in
+     the daemon's key store and prints its key ID; --key-id <id>[:<offset>] in
+     place of <key> then uses that pad, so only the message crosses the wire.
+     --pad <file>[:<offset>] in place of <key> takes the key from a local pad
+     file (see otp_pad.h, made with keygen --pad): the message's key chars are
+     claimed from the pad's watermark (or at offset) and are never handed out
+     again, so one pad serves any number of messages without a keygen run or
+     key file per message. An encrypting and a decrypting copy of the same pad
+     stay in step as long as messages are decrypted in the order they were
+     encrypted; otherwise the offset is given explicitly. --packed sets the
+     header's packed flag on every request, selecting the packed wire encoding
+     (5 bits per char, see otp_proto.h), which cuts the bytes on the wire by
+     37.5% at the cost of packing and unpacking on both ends.
+     The socket primitives underneath are those of libotp (see otp_lib.h); the
+     functions here add the clients' error reporting and exit values.
+ Reference Citation: Kernighan & Ritchie, "The C Programming Language", ISBN: 0131103628
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include "otp_proto.h"
+#include "otp_pad.h"
+
+#define ASCII_CAP_MAX 90
+#define ASCII_CAP_MIN 65
+#define MAP_WINDOW (4 * 1024 * 1024)    // Bytes of a mapping kept resident at a time
+
+// Describes the client being run (otp_enc or otp_dec)
+struct CliMode {
+    const char* progName;   // Used in error messages
+    char cliType;           // Type announced to the daemon ('E' or 'D')
+    const char* servName;   // Daemon the client expects to reach
+    const char* rejectMsg;  // Reported when the daemon refuses the client
+};
+
+// Settings parsed from the command line
+struct CliConfig {
+    char* fileName;         // Message file (single message mode)
+    char* keyName;          // Key file (single message mode)
+    char* listName;         // File of "<file> <key>" lines (--batch), else NULL
+    char* uploadName;       // Pad to store with the daemon (--upload), else NULL
+    int useKeyId;           // 1 if the key is a stored pad (--key-id)
+    unsigned long long keyId;       // Stored pad to use
+    unsigned long long keyOffset;   // First pad char to use
+    char* padName;          // Local pad file (--pad), else NULL
+    unsigned long long padOffset;   // First local pad char to use, or PAD_NEXT
+    int servPort;
+    char* unixPath;         // Daemon's unix domain socket (--unix), else NULL
+    int packed;             // 1 to send requests in the packed encoding
+};
+
+// One message of a batch
+struct BatchEntry {
+    char* fileName;
+    char* keyName;
+    long long fileLen;
+};
+
+// Input file mapped read-only into memory
+struct MappedFile {
+    char* fileName;
+    char* data;             // Mapped contents (NULL for an empty file)
+    char* mapBase;          // Start of the mapping (data may point into it)
+    size_t mapLen;          // Bytes mapped (the file size)
+    long long len;          // Message chars (trailing newline excluded)
+};
+
+// Function Prototypes
+void parseCliArgs(int argc, const char* argv[], struct CliConfig* config);
+void mapFile(char* fileName, struct MappedFile* mapped);
+void releaseMapped(struct MappedFile* mapped, long long upTo);
+void unmapFile(struct MappedFile* mapped);
+void validateKeyLen(long long fileLen, long long keyLen);
+void validateFile(struct MappedFile* mapped, struct CliMode* mode);
+int createSock(struct CliConfig* config, struct CliMode* mode);
+void failRequest(char status, int op, long long fileLen, struct CliConfig* config, struct CliMode* mode);
+unsigned long long uploadKey(int sockfd, struct MappedFile* pad, struct CliConfig* config, struct CliMode* mode);
+void claimPadKey(long long fileLen, struct CliConfig* config, struct MappedFile* key, struct CliMode* mode);
+void streamTransfer(int sockfd, struct MappedFile* file, struct MappedFile* key,
+                    struct CliConfig* config, struct CliMode* mode);
+struct BatchEntry* readBatchList(char* listName, int* numEntries, struct CliMode* mode);
+void batchTransfer(int sockfd, struct BatchEntry* entries, int numEntries,
+                   struct CliConfig* config, struct CliMode* mode);
+int sendData(int sockfd, char* dataToSend, int len);
+int recvAll(int sockfd, char* msgBuff, int len);
+
+#endif
@@ -0,0 +1,551 @@
+/**********************************************************************************
+ Module Name: otp_codec
+ Description: Mod-27 one-time pad kernels with runtime CPU dispatch. See
+     otp_codec.h. The vector kernels work on 16 or 32 chars at a time:
+       symbol = (char == ' ') ? 0 : char - '@'
+       encrypt: sum = d + k (0..52), then min_u8(sum, sum - 27). When sum < 27
+                the subtraction wraps to >= 229, so the unsigned minimum keeps
+                sum; otherwise it picks sum - 27.
+       decrypt: diff = d - k (-26..26), then min_u8(diff, diff + 27). A negative
+                diff is >= 230 as unsigned and diff + 27 wraps to 1..26.
+       char = symbol + '@', with symbol 0 mapped back to ' '.
+       valid: char == ' ', or min_u8(char - 'A', 25) == char - 'A'.
+     Any tail shorter than one vector is finished by the scalar kernel.
+     Packing (see PACKED_LEN in otp_proto.h) turns each group of 8 symbols into
+     one 40-bit little-endian value, symbol j in bits 5j..5j+4. The vector
+     kernels build it in 64-bit lanes with shift/or steps (8 x 5 bits -> 4 x 10
+     -> 2 x 20 -> 40) and unpack by running the steps backwards; SSE2 stores
+     two 5-byte groups with overlapping 8-byte stores, AVX2 gathers four with
+     a byte shuffle.
+ Reference Citation: https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "otp_proto.h"
+#include "otp_codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CODEC_X86 1
+#include <immintrin.h>
+#endif
+
+
+// Kernel chosen by selectCodec() (resolved on first use)
+static TransformFx encryptImpl = NULL;
+static TransformFx decryptImpl = NULL;
+static size_t (*findBadImpl)(const char* data, size_t len) = NULL;
+static PackFx packImpl = NULL;
+static PackFx unpackImpl = NULL;
+static const char* implName = "none";
+
+
+/***********************************************************************
+ * Function Name: encryptScalar
+ * Description: This function takes a message to encrypt and key, and
+    writes the encrypted version of the message to cipherBuff. It is
+    the reference kernel and handles the tails of the vector kernels.
+ **********************************************************************/
+static void encryptScalar(const char* data, const char* key, char* cipherBuff, size_t len)
+{
+    char encryptedChar;
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        // Manipulate ASCII values for calculation (space counts as '@', therefore, vals b/n 0 and 26)
+        int nxtDataChar = (data[i] == ASCII_SPACE) ? 0 : (int) data[i] - ASCII_MIN;
+        int nxtKeyChar = (key[i] == ASCII_SPACE) ? 0 : (int) key[i] - ASCII_MIN;
+
+        // Perform encryption calculation
+        encryptedChar = (nxtDataChar + nxtKeyChar) % 27;
+        encryptedChar += 64;    // Convert back to corresponding ASCII value
+        cipherBuff[i] = (char) encryptedChar;    // Cast and add to encrypted string
+
+        // Convert '@' back to ' ' if applicable
+        if(cipherBuff[i] == ASCII_MIN) {
+            cipherBuff[i] = ASCII_SPACE;
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: decryptScalar
+ * Description: This function takes a message to decrypt and a key, and
+    writes the decrypted version of the message to decryptBuff.
+ **********************************************************************/
+static void decryptScalar(const char* data, const char* key, char* decryptBuff, size_t len)
+{
+    char decryptedChar;
+    size_t i;
+
+    for(i = 0; i < len; i++)   // For each character
+    {
+        // Manipulate ASCII values for calculation (space counts as '@', therefore, vals b/n 0 and 26)
+        int nxtDataChar = (data[i] == ASCII_SPACE) ? 0 : (int) data[i] - ASCII_MIN;
+        int nxtKeyChar = (key[i] == ASCII_SPACE) ? 0 : (int) key[i] - ASCII_MIN;
+
+        // Perform decryption calculation (adding 27 to handle possible negative)
+        if((decryptedChar = (nxtDataChar - nxtKeyChar)) % 27 < 0){
+            decryptedChar += 27;
+        }
+
+        decryptedChar += 64;    // Convert back to corresponding ASCII value
+        decryptBuff[i] = (char) decryptedChar;    // Cast and add to decrypted string
+
+        // Convert '@' back to ' ' if applicable
+        if(decryptBuff[i] == ASCII_MIN) {
+            decryptBuff[i] = ASCII_SPACE;
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: findBadScalar
+ * Description: This function returns the index of the first char that
+    is neither a capital letter nor a space, or len if there is none.
+ **********************************************************************/
+static size_t findBadScalar(const char* data, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        if(!(data[i] == ASCII_SPACE || (data[i] > ASCII_MIN && data[i] <= ASCII_MAX))) {
+            break;
+        }
+    }
+    return i;
+}
+
+
+/***********************************************************************
+ * Function Name: packScalar
+ * Description: This function packs len chars into PACKED_LEN(len) bytes,
+    one group of 8 symbols (or fewer, for the last group) at a time. A
+    group is read whole before it is written, so packed may be chars.
+ **********************************************************************/
+static void packScalar(const char* chars, char* packed, size_t len)
+{
+    unsigned long long bits;
+    size_t i, j, groupLen;
+
+    for(i = 0; i < len; i += 8)
+    {
+        groupLen = (len - i < 8) ? len - i : 8;
+        bits = 0;
+        for(j = 0; j < groupLen; j++) {
+            bits |= (unsigned long long) ((chars[i + j] == ASCII_SPACE) ? 0 : chars[i + j] - ASCII_MIN) << (5 * j);
+        }
+        for(j = 0; j < PACKED_LEN(groupLen); j++) {
+            *packed++ = (char) (bits >> (8 * j));
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: unpackScalar
+ * Description: This function unpacks PACKED_LEN(len) bytes into len
+    chars. Fields outside the alphabet (27-31) are passed through as
+    chars past 'Z', which the clients' checks and codec tolerate.
+ **********************************************************************/
+static void unpackScalar(const char* packed, char* chars, size_t len)
+{
+    unsigned long long bits;
+    size_t i, j, groupLen;
+    int symbol;
+
+    for(i = 0; i < len; i += 8)
+    {
+        groupLen = (len - i < 8) ? len - i : 8;
+        bits = 0;
+        for(j = 0; j < PACKED_LEN(groupLen); j++) {
+            bits |= (unsigned long long) (unsigned char) *packed++ << (8 * j);
+        }
+        for(j = 0; j < groupLen; j++) {
+            symbol = (int) ((bits >> (5 * j)) & 0x1F);
+            chars[i + j] = (symbol == 0) ? ASCII_SPACE : (char) (symbol + ASCII_MIN);
+        }
+    }
+}
+
+
+#ifdef CODEC_X86
+/***********************************************************************
+ * SSE2 kernels (baseline on every x86-64 CPU)
+ **********************************************************************/
+static inline __m128i toSymbols128(__m128i chars)
+{
+    __m128i isSpace = _mm_cmpeq_epi8(chars, _mm_set1_epi8(ASCII_SPACE));
+    return _mm_andnot_si128(isSpace, _mm_sub_epi8(chars, _mm_set1_epi8(ASCII_MIN)));
+}
+
+static inline __m128i toChars128(__m128i syms)
+{
+    __m128i isZero = _mm_cmpeq_epi8(syms, _mm_setzero_si128());
+    __m128i chars = _mm_add_epi8(syms, _mm_set1_epi8(ASCII_MIN));
+    return _mm_sub_epi8(chars, _mm_and_si128(isZero, _mm_set1_epi8(ASCII_MIN - ASCII_SPACE)));
+}
+
+static void encryptSse2(const char* data, const char* key, char* cipherBuff, size_t len)
+{
+    size_t i;
+    __m128i sum;
+
+    for(i = 0; i + 16 <= len; i += 16)
+    {
+        sum = _mm_add_epi8(toSymbols128(_mm_loadu_si128((const __m128i*) (data + i))),
+                           toSymbols128(_mm_loadu_si128((const __m128i*) (key + i))));
+        sum = _mm_min_epu8(sum, _mm_sub_epi8(sum, _mm_set1_epi8(27)));
+        _mm_storeu_si128((__m128i*) (cipherBuff + i), toChars128(sum));
+    }
+    encryptScalar(data + i, key + i, cipherBuff + i, len - i);
+}
+
+static void decryptSse2(const char* data, const char* key, char* decryptBuff, size_t len)
+{
+    size_t i;
+    __m128i diff;
+
+    for(i = 0; i + 16 <= len; i += 16)
+    {
+        diff = _mm_sub_epi8(toSymbols128(_mm_loadu_si128((const __m128i*) (data + i))),
+                            toSymbols128(_mm_loadu_si128((const __m128i*) (key + i))));
+        diff = _mm_min_epu8(diff, _mm_add_epi8(diff, _mm_set1_epi8(27)));
+        _mm_storeu_si128((__m128i*) (decryptBuff + i), toChars128(diff));
+    }
+    decryptScalar(data + i, key + i, decryptBuff + i, len - i);
+}
+
+// A char is valid when it is ' ' or when (char - 'A') as unsigned is <= 25
+static size_t findBadSse2(const char* data, size_t len)
+{
+    size_t i;
+    __m128i chars, offset, valid;
+    int validMask;
+
+    for(i = 0; i + 16 <= len; i += 16)
+    {
+        chars = _mm_loadu_si128((const __m128i*) (data + i));
+        offset = _mm_sub_epi8(chars, _mm_set1_epi8(ASCII_MIN + 1));
+        valid = _mm_or_si128(_mm_cmpeq_epi8(offset, _mm_min_epu8(offset, _mm_set1_epi8(25))),
+                             _mm_cmpeq_epi8(chars, _mm_set1_epi8(ASCII_SPACE)));
+        if((validMask = _mm_movemask_epi8(valid)) != 0xFFFF) {
+            return i + __builtin_ctz(~validMask);
+        }
+    }
+    return i + findBadScalar(data + i, len - i);
+}
+
+// 16 symbols -> two 40-bit groups, one in the low bits of each 64-bit lane
+static inline __m128i packLanes128(__m128i syms)
+{
+    __m128i pairs = _mm_or_si128(_mm_and_si128(syms, _mm_set1_epi16(0x00FF)),
+                                 _mm_slli_epi16(_mm_srli_epi16(syms, 8), 5));
+    __m128i quads = _mm_or_si128(_mm_and_si128(pairs, _mm_set1_epi32(0xFFFF)),
+                                 _mm_slli_epi32(_mm_srli_epi32(pairs, 16), 10));
+    return _mm_or_si128(_mm_and_si128(quads, _mm_set1_epi64x(0xFFFFFFFFLL)),
+                        _mm_slli_epi64(_mm_srli_epi64(quads, 32), 20));
+}
+
+// Two 40-bit groups (zero-extended 64-bit lanes) -> 16 symbols
+static inline __m128i unpackLanes128(__m128i groups)
+{
+    __m128i quads = _mm_or_si128(_mm_and_si128(groups, _mm_set1_epi64x(0xFFFFF)),
+                                 _mm_and_si128(_mm_slli_epi64(groups, 12), _mm_set1_epi64x(0xFFFFF00000000LL)));
+    __m128i pairs = _mm_or_si128(_mm_and_si128(quads, _mm_set1_epi32(0x3FF)),
+                                 _mm_and_si128(_mm_slli_epi32(quads, 6), _mm_set1_epi32(0x3FF0000)));
+    return _mm_or_si128(_mm_and_si128(pairs, _mm_set1_epi16(0x1F)),
+                        _mm_and_si128(_mm_slli_epi16(pairs, 3), _mm_set1_epi16(0x1F00)));
+}
+
+// Each step stores 13 bytes (or reads 13), so the loop stops while at least
+// 32 chars remain and the packed side has room to spare
+static void packSse2(const char* chars, char* packed, size_t len)
+{
+    size_t i;
+    __m128i groups;
+
+    for(i = 0; i + 32 <= len; i += 16)
+    {
+        groups = packLanes128(toSymbols128(_mm_loadu_si128((const __m128i*) (chars + i))));
+        _mm_storel_epi64((__m128i*) packed, groups);
+        _mm_storel_epi64((__m128i*) (packed + 5), _mm_unpackhi_epi64(groups, groups));
+        packed += 10;
+    }
+    packScalar(chars + i, packed, len - i);
+}
+
+static void unpackSse2(const char* packed, char* chars, size_t len)
+{
+    size_t i;
+    __m128i groups;
+
+    for(i = 0; i + 32 <= len; i += 16)
+    {
+        groups = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*) packed),
+                                    _mm_loadl_epi64((const __m128i*) (packed + 5)));
+        groups = _mm_and_si128(groups, _mm_set1_epi64x(0xFFFFFFFFFFLL));
+        _mm_storeu_si128((__m128i*) (chars + i), toChars128(unpackLanes128(groups)));
+        packed += 10;
+    }
+    unpackScalar(packed, chars + i, len - i);
+}
+
+
+/***********************************************************************
+ * AVX2 kernels (selected at runtime when the CPU supports them)
+ **********************************************************************/
+__attribute__((target("avx2")))
+static inline __m256i toSymbols256(__m256i chars)
+{
+    __m256i isSpace = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(ASCII_SPACE));
+    return _mm256_andnot_si256(isSpace, _mm256_sub_epi8(chars, _mm256_set1_epi8(ASCII_MIN)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i toChars256(__m256i syms)
+{
+    __m256i isZero = _mm256_cmpeq_epi8(syms, _mm256_setzero_si256());
+    __m256i chars = _mm256_add_epi8(syms, _mm256_set1_epi8(ASCII_MIN));
+    return _mm256_sub_epi8(chars, _mm256_and_si256(isZero, _mm256_set1_epi8(ASCII_MIN - ASCII_SPACE)));
+}
+
+__attribute__((target("avx2")))
+static void encryptAvx2(const char* data, const char* key, char* cipherBuff, size_t len)
+{
+    size_t i;
+    __m256i sum;
+
+    for(i = 0; i + 32 <= len; i += 32)
+    {
+        sum = _mm256_add_epi8(toSymbols256(_mm256_loadu_si256((const __m256i*) (data + i))),
+                              toSymbols256(_mm256_loadu_si256((const __m256i*) (key + i))));
+        sum = _mm256_min_epu8(sum, _mm256_sub_epi8(sum, _mm256_set1_epi8(27)));
+        _mm256_storeu_si256((__m256i*) (cipherBuff + i), toChars256(sum));
+    }
+    encryptScalar(data + i, key + i, cipherBuff + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void decryptAvx2(const char* data, const char* key, char* decryptBuff, size_t len)
+{
+    size_t i;
+    __m256i diff;
+
+    for(i = 0; i + 32 <= len; i += 32)
+    {
+        diff = _mm256_sub_epi8(toSymbols256(_mm256_loadu_si256((const __m256i*) (data + i))),
+                               toSymbols256(_mm256_loadu_si256((const __m256i*) (key + i))));
+        diff = _mm256_min_epu8(diff, _mm256_add_epi8(diff, _mm256_set1_epi8(27)));
+        _mm256_storeu_si256((__m256i*) (decryptBuff + i), toChars256(diff));
+    }
+    decryptScalar(data + i, key + i, decryptBuff + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t findBadAvx2(const char* data, size_t len)
+{
+    size_t i;
+    __m256i chars, offset, valid;
+    unsigned int validMask;
+
+    for(i = 0; i + 32 <= len; i += 32)
+    {
+        chars = _mm256_loadu_si256((const __m256i*) (data + i));
+        offset = _mm256_sub_epi8(chars, _mm256_set1_epi8(ASCII_MIN + 1));
+        valid = _mm256_or_si256(_mm256_cmpeq_epi8(offset, _mm256_min_epu8(offset, _mm256_set1_epi8(25))),
+                                _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(ASCII_SPACE)));
+        if((validMask = (unsigned int) _mm256_movemask_epi8(valid)) != 0xFFFFFFFFu) {
+            return i + __builtin_ctz(~validMask);
+        }
+    }
+    return i + findBadScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i packLanes256(__m256i syms)
+{
+    __m256i pairs = _mm256_or_si256(_mm256_and_si256(syms, _mm256_set1_epi16(0x00FF)),
+                                    _mm256_slli_epi16(_mm256_srli_epi16(syms, 8), 5));
+    __m256i quads = _mm256_or_si256(_mm256_and_si256(pairs, _mm256_set1_epi32(0xFFFF)),
+                                    _mm256_slli_epi32(_mm256_srli_epi32(pairs, 16), 10));
+    return _mm256_or_si256(_mm256_and_si256(quads, _mm256_set1_epi64x(0xFFFFFFFFLL)),
+                           _mm256_slli_epi64(_mm256_srli_epi64(quads, 32), 20));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i unpackLanes256(__m256i groups)
+{
+    __m256i quads = _mm256_or_si256(_mm256_and_si256(groups, _mm256_set1_epi64x(0xFFFFF)),
+                                    _mm256_and_si256(_mm256_slli_epi64(groups, 12), _mm256_set1_epi64x(0xFFFFF00000000LL)));
+    __m256i pairs = _mm256_or_si256(_mm256_and_si256(quads, _mm256_set1_epi32(0x3FF)),
+                                    _mm256_and_si256(_mm256_slli_epi32(quads, 6), _mm256_set1_epi32(0x3FF0000)));
+    return _mm256_or_si256(_mm256_and_si256(pairs, _mm256_set1_epi16(0x1F)),
+                           _mm256_and_si256(_mm256_slli_epi16(pairs, 3), _mm256_set1_epi16(0x1F00)));
+}
+
+// The shuffle moves each 128-bit lane's two groups to its first 10 bytes
+// (and back), so 32 chars become two overlapping 16-byte stores
+__attribute__((target("avx2")))
+static void packAvx2(const char* chars, char* packed, size_t len)
+{
+    size_t i;
+    __m256i groups;
+    const __m256i gather = _mm256_setr_epi8(0, 1, 2, 3, 4, 8, 9, 10, 11, 12, -1, -1, -1, -1, -1, -1,
+                                            0, 1, 2, 3, 4, 8, 9, 10, 11, 12, -1, -1, -1, -1, -1, -1);
+
+    for(i = 0; i + 64 <= len; i += 32)
+    {
+        groups = _mm256_shuffle_epi8(packLanes256(toSymbols256(_mm256_loadu_si256((const __m256i*) (chars + i)))), gather);
+        _mm_storeu_si128((__m128i*) packed, _mm256_castsi256_si128(groups));
+        _mm_storeu_si128((__m128i*) (packed + 10), _mm256_extracti128_si256(groups, 1));
+        packed += 20;
+    }
+    packSse2(chars + i, packed, len - i);
+}
+
+__attribute__((target("avx2")))
+static void unpackAvx2(const char* packed, char* chars, size_t len)
+{
+    size_t i;
+    __m256i groups;
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, 3, 4, -1, -1, -1, 5, 6, 7, 8, 9, -1, -1, -1,
+                                            0, 1, 2, 3, 4, -1, -1, -1, 5, 6, 7, 8, 9, -1, -1, -1);
+
+    for(i = 0; i + 64 <= len; i += 32)
+    {
+        groups = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) packed)),
+                                         _mm_loadu_si128((const __m128i*) (packed + 10)), 1);
+        groups = unpackLanes256(_mm256_shuffle_epi8(groups, spread));
+        _mm256_storeu_si256((__m256i*) (chars + i), toChars256(groups));
+        packed += 20;
+    }
+    unpackSse2(packed, chars + i, len - i);
+}
+#endif
+
+
+/***********************************************************************
+ * Function Name: selectCodec
+ * Description: This function picks the kernels used by encryptData and
+    decryptData. With a NULL name the fastest kernel supported by the
+    CPU is chosen; "avx2", "sse2" or "scalar" force one (e.g. for
+    benchmarking). Returns 0 on success, -1 if the kernel is unavailable.
+ * Reference Citation: https://gcc.gnu.org/onlinedocs/gcc/x86-Built-in-Functions.html
+ **********************************************************************/
+int selectCodec(const char* codecName)
+{
+#ifdef CODEC_X86
+    __builtin_cpu_init();
+    if((codecName == NULL && __builtin_cpu_supports("avx2")) ||
+       (codecName != NULL && strcmp(codecName, "avx2") == 0)) {
+        if(!__builtin_cpu_supports("avx2")) { return -1; }
+        encryptImpl = encryptAvx2;
+        decryptImpl = decryptAvx2;
+        findBadImpl = findBadAvx2;
+        packImpl = packAvx2;
+        unpackImpl = unpackAvx2;
+        implName = "avx2";
+        return 0;
+    }
+    if(codecName == NULL || strcmp(codecName, "sse2") == 0) {
+        encryptImpl = encryptSse2;
+        decryptImpl = decryptSse2;
+        findBadImpl = findBadSse2;
+        packImpl = packSse2;
+        unpackImpl = unpackSse2;
+        implName = "sse2";
+        return 0;
+    }
+#endif
+    if(codecName == NULL || strcmp(codecName, "scalar") == 0) {
+        encryptImpl = encryptScalar;
+        decryptImpl = decryptScalar;
+        findBadImpl = findBadScalar;
+        packImpl = packScalar;
+        unpackImpl = unpackScalar;
+        implName = "scalar";
+        return 0;
+    }
+    return -1;
+}
+
+
+/***********************************************************************
+ * Function Name: codecName
+ * Description: This function returns the name of the selected kernel.
+ **********************************************************************/
+const char* codecName(void)
+{
+    if(encryptImpl == NULL) { selectCodec(NULL); }
+    return implName;
+}
+
+
+/***********************************************************************
+ * Function Name: encryptData
+ * Description: This function takes a message to encrypt and key, each
+    len chars long, and writes the encrypted version of the message to
+    cipherBuff. cipherBuff may be the same buffer as data.
+ **********************************************************************/
+void encryptData(const char* data, const char* key, char* cipherBuff, size_t len)
+{
+    if(encryptImpl == NULL) { selectCodec(NULL); }
+    encryptImpl(data, key, cipherBuff, len);
+}
+
+
+/***********************************************************************
+ * Function Name: decryptData
+ * Description: This function takes a message to decrypt and a key, each
+    len chars long, and writes the decrypted version of the message to
+    decryptBuff. decryptBuff may be the same buffer as data.
+ **********************************************************************/
+void decryptData(const char* data, const char* key, char* decryptBuff, size_t len)
+{
+    if(decryptImpl == NULL) { selectCodec(NULL); }
+    decryptImpl(data, key, decryptBuff, len);
+}
+
+
+/***********************************************************************
+ * Function Name: findBadChar
+ * Description: This function scans len chars for one outside the
+    27-symbol alphabet. Returns its index, or len if all are valid.
+ **********************************************************************/
+size_t findBadChar(const char* data, size_t len)
+{
+    if(findBadImpl == NULL) { selectCodec(NULL); }
+    return findBadImpl(data, len);
+}
+
+
+/***********************************************************************
+ * Function Name: packSymbols
+ * Description: This function packs len chars of the 27-symbol alphabet
+    into PACKED_LEN(len) bytes of 5-bit fields. packed may be the same
+    buffer as chars (the result then fills its start).
+ **********************************************************************/
+void packSymbols(const char* chars, char* packed, size_t len)
+{
+    if(packImpl == NULL) { selectCodec(NULL); }
+    packImpl(chars, packed, len);
+}
+
+
+/***********************************************************************
+ * Function Name: unpackSymbols
+ * Description: This function unpacks PACKED_LEN(len) bytes into len
+    chars. packed may also lie at the very end of the chars buffer
+    (chars + len - PACKED_LEN(len)), so a packed chunk can be received
+    into the tail of its chunk buffer and expanded in place.
+ **********************************************************************/
+void unpackSymbols(const char* packed, char* chars, size_t len)
+{
+    if(unpackImpl == NULL) { selectCodec(NULL); }
+    unpackImpl(packed, chars, len);
+}
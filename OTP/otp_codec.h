@@ -0,0 +1,36 @@
+#ifndef otp_codec_h
+#define otp_codec_h
+/**********************************************************************************
+ Module Name: otp_codec
+ Description: Mod-27 one-time pad kernels used by the daemons. The 27 symbols are
+     space (0) and 'A'-'Z' (1-26); encryption adds the key symbol mod 27 and
+     decryption subtracts it. Besides the scalar reference loop there are 128-bit
+     (SSE2) and 256-bit (AVX2) kernels that map symbols and reduce mod 27 with
+     compare/subtract instead of division. The fastest kernel the CPU supports is
+     picked on first use; all kernels give byte-identical output for input drawn
+     from the 27-symbol alphabet. The same dispatch provides findBadChar(), which
+     the clients use to validate their input files in bulk, and the 5-bit
+     packSymbols()/unpackSymbols() used on conxs that negotiated the packed
+     wire encoding (see otp_proto.h).
+ *********************************************************************************/
+
+#include <stddef.h>
+
+#define ASCII_SPACE 32  // ' '
+#define ASCII_MIN   64  // '@' to swap with space
+#define ASCII_MAX   90  // 'Z'
+
+// Signature shared by every kernel (and by the daemons' ServMode transform)
+typedef void (*TransformFx)(const char* data, const char* key, char* outBuff, size_t len);
+typedef void (*PackFx)(const char* src, char* dst, size_t len);
+
+// Function Prototypes
+void encryptData(const char* data, const char* key, char* cipherBuff, size_t len);
+void decryptData(const char* data, const char* key, char* decryptBuff, size_t len);
+size_t findBadChar(const char* data, size_t len);
+void packSymbols(const char* chars, char* packed, size_t len);
+void unpackSymbols(const char* packed, char* chars, size_t len);
+int selectCodec(const char* codecName);
+const char* codecName(void);
+
+#endif
@@ -0,0 +1,497 @@
+/**********************************************************************************
+ Module Name: otp_conx
+ Description: Per-conx protocol state machine shared by every I/O engine of the OTP
+     daemons. A conx moves through handshake byte -> permission reply -> length,
+     then loops message chunk -> key chunk -> transform -> write-back until the
+     whole message has streamed through, then waits for the next message's length on
+     the same conx (see otp_proto.h). Key store requests take side paths: an upload
+     streams pad chunks into the store and replies with the key ID, and a keyed
+     message reads the key ID and offset, then transforms each message chunk against
+     the stored pad, so no key chunk is ever received. A header conx (step 9 of
+     otp_proto.h) skips the permission reply: each request starts with a header that
+     is validated on its own, and only a failure is answered, with an error status
+     after which the conx is closed. On a conx that negotiated the packed encoding
+     each chunk is received into the tail of its buffer and unpacked in place, and
+     the transformed chunk is packed in place before it is written back, so the
+     engines' buffers (registered ones included) serve both encodings. Chunks are
+     transformed in place too, so a conx needs a message and a key buffer only;
+     unless the engine supplies its own, they are borrowed from the slab pool (see
+     otp_slab.h) for each request, sized to it, and returned when it is done, so the
+     request path allocates nothing once the pool is warm. The state machine never
+     touches the socket itself: it only tells the engine which buffer to fill or
+     drain next, so the same code serves blocking and event-driven engines. Each
+     conx carries the kernel its client type is served with (see servTransform()):
+     fixed at the handshake, or picked per request from the header, so one otp_d
+     conx may mix both. Phase latencies and counters are recorded here too (see
+     otp_stats.h), so every engine reports the same metrics.
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include "otp_serv.h"
+
+
+/***********************************************************************
+ * Function Name: setConxIo
+ * Description: This helper points the conx at its next read or write.
+ **********************************************************************/
+static void setConxIo(struct Conx* conx, enum ConxState state, void* buff, int len, int isWrite)
+{
+    conx->state = state;
+    conx->ioBuff = (char*) buff;
+    conx->ioLen = len;
+    conx->ioDone = 0;
+    conx->isWrite = isWrite;
+}
+
+
+/***********************************************************************
+ * Function Name: setChunkRead
+ * Description: This helper points the conx at the read of the current
+    chunk into buff. A packed chunk is read into the end of buff, where
+    unpackSymbols() can expand it in place.
+ **********************************************************************/
+static void setChunkRead(struct Conx* conx, enum ConxState state, char* buff)
+{
+    int wireLen = conx->packed ? (int) PACKED_LEN(conx->chunkLen) : conx->chunkLen;
+
+    setConxIo(conx, state, buff + conx->chunkLen - wireLen, wireLen, 0);
+}
+
+
+/***********************************************************************
+ * Function Name: unpackChunk
+ * Description: This helper expands the packed chunk just read into buff.
+ **********************************************************************/
+static void unpackChunk(struct Conx* conx, char* buff)
+{
+    if(conx->packed) {
+        unpackSymbols(conx->ioBuff, buff, conx->chunkLen);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: endPhase
+ * Description: This helper records the phase that ends now and starts
+    timing the next one.
+ **********************************************************************/
+static void endPhase(struct Conx* conx, enum StatPhase phase)
+{
+    long long now = statsNow();
+
+    statsRecord(phase, conx->phaseStart, now);
+    conx->phaseStart = now;
+}
+
+
+/***********************************************************************
+ * Function Name: transformChunk
+ * Description: This helper runs the codec on the current chunk (split
+    among the transform threads for a large message), timing it, and
+    sets up the write-back of the result.
+ **********************************************************************/
+static void transformChunk(struct Conx* conx, const char* key)
+{
+    endPhase(conx, PHASE_RECEIVE);
+    tpoolTransform(conx->transform, conx->fileBuff, key, conx->fileBuff, conx->chunkLen, conx->msgLen);
+    if(conx->packed) {
+        packSymbols(conx->fileBuff, conx->fileBuff, conx->chunkLen);
+    }
+    endPhase(conx, PHASE_TRANSFORM);
+    setConxIo(conx, CONX_WRITEBACK, conx->fileBuff,
+              conx->packed ? (int) PACKED_LEN(conx->chunkLen) : conx->chunkLen, 1);
+}
+
+
+/***********************************************************************
+ * Function Name: releaseChunkBuffs
+ * Description: This helper returns the slab the conx borrowed, if any
+    (engine-owned buffers are left to the engine).
+ **********************************************************************/
+static void releaseChunkBuffs(struct Conx* conx)
+{
+    if(conx->slab != NULL) {
+        slabPut(conx->slab);
+        conx->slab = NULL;
+        conx->fileBuff = conx->keyBuff = NULL;
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: keySide
+ * Description: This helper returns which copy of a stored pad the
+    current request uses: its client type's on otp_d, else the only one
+    (see otp_keystore.h).
+ **********************************************************************/
+static char keySide(struct Conx* conx, struct ServMode* mode)
+{
+    return (mode->cliType == CLI_ANY) ? conx->cliType : 0;
+}
+
+
+/***********************************************************************
+ * Function Name: waitForRequest
+ * Description: This helper sets up the read of the next request's
+    length word (or header, on a header conx). The request's deadline
+    runs from here.
+ **********************************************************************/
+static void waitForRequest(struct Conx* conx)
+{
+    conx->requestStart = statsNow();
+    if(conx->headerConx) {
+        setConxIo(conx, CONX_HEADER, &conx->header, HDR_SIZE, 0);
+    }
+    else {
+        setConxIo(conx, CONX_LENGTH, &conx->msgLen, sizeof(conx->msgLen), 0);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: setNextChunk
+ * Description: This helper sets up the read of the next message chunk.
+    Once the whole message has been streamed the conx is kept alive and
+    waits for the next message's length. The deadline restarts with
+    every chunk, so a long stream that keeps moving is never cut off.
+ **********************************************************************/
+static int setNextChunk(struct Conx* conx)
+{
+    if(conx->msgLeft == 0) {
+        conx->padKey = NULL;
+        releaseChunkBuffs(conx);
+        waitForRequest(conx);
+        return 0;
+    }
+    conx->requestStart = statsNow();     // Each chunk of a long stream gets its own deadline
+    conx->chunkLen = (conx->msgLeft < CHUNK_SIZE) ? (int) conx->msgLeft : CHUNK_SIZE;
+    conx->msgLeft -= conx->chunkLen;
+    setChunkRead(conx, (conx->op == OP_KEY_UPLOAD) ? CONX_UPLOAD : CONX_DATA, conx->fileBuff);
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: setStatusReply
+ * Description: This helper sets up the write of a key store status
+    char, followed by the key ID for an upload reply.
+ **********************************************************************/
+static int setStatusReply(struct Conx* conx, enum ConxState state, char status, unsigned long long keyId)
+{
+    unsigned long long wireId = htobe64(keyId);
+
+    conx->reply[0] = status;
+    memcpy(conx->reply + 1, &wireId, sizeof(wireId));
+    setConxIo(conx, state, conx->reply, (state == CONX_UPLOAD_REPLY) ? sizeof(conx->reply) : 1, 1);
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: setErrorReply
+ * Description: This helper sets up the write of an error status on a
+    header conx. The conx is closed once it is delivered.
+ **********************************************************************/
+static int setErrorReply(struct Conx* conx, char status)
+{
+    conx->reply[0] = REPLY_ERROR;
+    conx->reply[1] = status;
+    conx->failed = 1;
+    setConxIo(conx, CONX_ERROR_REPLY, conx->reply, 2, 1);
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: finishUpload
+ * Description: This helper completes a pad upload and sets up the
+    reply carrying its key ID ('N' if the store refused the pad or the
+    upload was discarded, an error status on a header conx).
+ **********************************************************************/
+static int finishUpload(struct Conx* conx, struct ServMode* mode)
+{
+    unsigned long long keyId = 0;
+    char status = (conx->upload != NULL &&
+                   keyUploadFinish(conx->upload, keySide(conx, mode), &keyId) == 0) ? 'Y' : 'N';
+
+    free(conx->upload);
+    conx->upload = NULL;
+    if(status == 'N' && conx->headerConx) {
+        return setErrorReply(conx, STATUS_KEY);
+    }
+    return setStatusReply(conx, CONX_UPLOAD_REPLY, status, keyId);
+}
+
+
+/***********************************************************************
+ * Function Name: checkHeader
+ * Description: This helper validates the request header just read and
+    takes the request's op, length and encoding from it. Returns 0, or
+    the status to refuse the request with.
+ **********************************************************************/
+static char checkHeader(struct Conx* conx, struct ServMode* mode)
+{
+    struct ReqHeader* header = &conx->header;
+
+    if(be32toh(header->magic) != HDR_MAGIC || header->version != HDR_VERSION ||
+       (header->flags & ~HDR_FLAGS_KNOWN) != 0 || header->op > OP_KEYED_MESSAGE ||
+       be64toh(header->length) > OP_LEN_MASK) {
+        return STATUS_VERSION;
+    }
+    if((conx->transform = servTransform(mode, (char) header->cliType)) == NULL) {
+        statsCount(STAT_REJECTED, 1);
+        return STATUS_REFUSED;
+    }
+    conx->cliType = (char) header->cliType;
+    conx->op = header->op;
+    conx->msgLen = be64toh(header->length);
+    conx->packed = (header->flags & HDR_PACKED) != 0;
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: borrowChunkBuffs
+ * Description: This helper borrows chunk buffers for the new request
+    from the slab pool, sized to its first chunk (the message or
+    CHUNK_SIZE, whichever is shorter). Returns 0, or -1 if out of memory.
+ **********************************************************************/
+static int borrowChunkBuffs(struct Conx* conx, struct ServMode* mode)
+{
+    if(conx->extBuffs) {
+        return 0;
+    }
+    conx->slab = slabGet((conx->msgLen < CHUNK_SIZE) ? (int) conx->msgLen : CHUNK_SIZE);
+    if(conx->slab == NULL) {
+        fprintf(stderr, "%s: out of memory.\n", mode->progName);
+        return -1;
+    }
+    conx->fileBuff = conx->slab->fileBuff;
+    conx->keyBuff = conx->slab->keyBuff;
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: beginUpload
+ * Description: This helper starts a pad upload into the key store.
+    Without a usable store the pad is still read (and discarded), so
+    the client gets a clean refusal instead of a reset conx.
+ **********************************************************************/
+static int beginUpload(struct Conx* conx, struct ServMode* mode)
+{
+    conx->upload = malloc(sizeof(struct KeyUpload));
+    if(conx->upload != NULL && keyUploadBegin(conx->upload) == -1) {
+        free(conx->upload);
+        conx->upload = NULL;
+    }
+    return (conx->msgLeft == 0) ? finishUpload(conx, mode) : setNextChunk(conx);
+}
+
+
+/***********************************************************************
+ * Function Name: conxInit
+ * Description: This function prepares a newly accepted conx. The first
+    step of every conx is reading the char identifying the client type.
+ **********************************************************************/
+void conxInit(struct Conx* conx, int sockfd)
+{
+    memset(conx, 0, sizeof(struct Conx));
+    conx->sockfd = sockfd;
+    conx->phaseStart = conx->requestStart = statsNow();
+    statsCount(STAT_ACCEPTED, 1);
+    setConxIo(conx, CONX_HANDSHAKE, &conx->cliType, sizeof(char), 0);
+}
+
+
+/***********************************************************************
+ * Function Name: conxUseBuffers
+ * Description: This function hands a conx chunk buffers owned by the
+    engine (each holding CHUNK_SIZE chars plus one), which the conx then
+    uses for every message instead of borrowing slabs.
+ **********************************************************************/
+void conxUseBuffers(struct Conx* conx, char* fileBuff, char* keyBuff)
+{
+    conx->fileBuff = fileBuff;
+    conx->keyBuff = keyBuff;
+    conx->extBuffs = 1;
+}
+
+
+/***********************************************************************
+ * Function Name: conxAdvance
+ * Description: This function is called by an engine once the current
+    step's ioLen bytes have been transferred. It acts on the completed
+    step and sets up the next one. Returns 0 if the conx should keep
+    going, or -1 if it is done (or failed) and should be closed.
+ **********************************************************************/
+int conxAdvance(struct Conx* conx, struct ServMode* mode)
+{
+    char status;
+
+    statsCount(conx->isWrite ? STAT_BYTES_OUT : STAT_BYTES_IN, conx->ioLen);
+
+    switch(conx->state)
+    {
+        case CONX_HANDSHAKE:        // Verify valid client type (lower case asks for packing)
+            endPhase(conx, PHASE_ACCEPT);
+            if(conx->cliType == (char) (HDR_MAGIC >> 24)) {    // Header conx: read the rest of the header
+                conx->headerConx = 1;
+                *(char*) &conx->header = conx->cliType;
+                setConxIo(conx, CONX_HEADER, (char*) &conx->header + 1, HDR_SIZE - 1, 0);
+                return 0;
+            }
+            conx->packed = (conx->cliType >= 'a' && conx->cliType <= 'z');
+            if(conx->packed) {
+                conx->cliType += 'A' - 'a';
+            }
+            conx->transform = servTransform(mode, conx->cliType);
+            conx->permToConnect = (conx->transform == NULL) ? 'N' : (conx->packed ? PERM_PACKED : 'Y');
+            setConxIo(conx, CONX_REPLY_PERM, &conx->permToConnect, sizeof(char), 1);
+            return 0;
+
+        case CONX_REPLY_PERM:       // Rejected clients are closed once notified
+            endPhase(conx, PHASE_HANDSHAKE);
+            if(conx->permToConnect == 'N') {
+                statsCount(STAT_REJECTED, 1);
+                conx->state = CONX_DONE;
+                return -1;
+            }
+            waitForRequest(conx);
+            return 0;
+
+        case CONX_LENGTH:           // Split op from length, size chunk buffers (no bigger than the message)
+            statsCount(STAT_REQUESTS, 1);
+            conx->phaseStart = statsNow();      // Time waiting for the request is not a phase
+            conx->msgLen = be64toh(conx->msgLen);
+            conx->op = (int) (conx->msgLen >> OP_SHIFT);
+            conx->msgLen &= OP_LEN_MASK;
+            conx->msgLeft = conx->msgLen;
+            if(borrowChunkBuffs(conx, mode) == -1) {
+                conx->state = CONX_DONE;
+                return -1;
+            }
+
+            if(conx->op == OP_MESSAGE) {
+                return setNextChunk(conx);
+            }
+            if(conx->op == OP_KEYED_MESSAGE) {
+                setConxIo(conx, CONX_KEY_REF, conx->keyRef, sizeof(conx->keyRef), 0);
+                return 0;
+            }
+            if(conx->op == OP_KEY_UPLOAD) {
+                return beginUpload(conx, mode);
+            }
+            fprintf(stderr, "%s: unknown request op %d.\n", mode->progName, conx->op);
+            conx->state = CONX_DONE;
+            return -1;
+
+        case CONX_HEADER:           // Whole request in one header: op, length, encoding and key range
+            statsCount(STAT_REQUESTS, 1);
+            conx->phaseStart = statsNow();      // Time waiting for the request is not a phase
+            if((status = checkHeader(conx, mode)) != 0) {
+                return setErrorReply(conx, status);
+            }
+            conx->msgLeft = conx->msgLen;
+            if(borrowChunkBuffs(conx, mode) == -1) {
+                conx->state = CONX_DONE;
+                return -1;
+            }
+            if(conx->op == OP_KEY_UPLOAD) {
+                return beginUpload(conx, mode);
+            }
+            if(conx->op == OP_KEYED_MESSAGE) {
+                conx->padKey = keyStoreClaim(keySide(conx, mode), be64toh(conx->header.keyId),
+                                             be64toh(conx->header.keyOffset), conx->msgLen);
+                if(conx->padKey == NULL) {
+                    return setErrorReply(conx, STATUS_KEY);
+                }
+            }
+            return setNextChunk(conx);
+
+        case CONX_DATA:
+            unpackChunk(conx, conx->fileBuff);
+            if(conx->padKey != NULL) {      // Keyed message: key chars come from the store
+                transformChunk(conx, conx->padKey);
+                conx->padKey += conx->chunkLen;
+                return 0;
+            }
+            setChunkRead(conx, CONX_KEY, conx->keyBuff);
+            return 0;
+
+        case CONX_KEY:              // Whole chunk arrived, transform and write back
+            unpackChunk(conx, conx->keyBuff);
+            transformChunk(conx, conx->keyBuff);
+            return 0;
+
+        case CONX_WRITEBACK:        // Chunk delivered, on to the next chunk or message
+            endPhase(conx, PHASE_SENDBACK);
+            return setNextChunk(conx);
+
+        case CONX_UPLOAD:           // Pad chunk arrived, append it to the store
+            unpackChunk(conx, conx->fileBuff);
+            if(conx->upload != NULL && keyUploadWrite(conx->upload, conx->fileBuff, conx->chunkLen) == -1) {
+                keyUploadAbort(conx->upload);       // Discard the rest of the pad
+                free(conx->upload);
+                conx->upload = NULL;
+            }
+            return (conx->msgLeft == 0) ? finishUpload(conx, mode) : setNextChunk(conx);
+
+        case CONX_UPLOAD_REPLY:     // Key ID delivered (refused uploads end the conx)
+            if(conx->reply[0] == 'N') {
+                conx->state = CONX_DONE;
+                return -1;
+            }
+            conx->msgLeft = 0;
+            return setNextChunk(conx);
+
+        case CONX_KEY_REF:          // Claim the pad range the message will use
+            conx->padKey = keyStoreClaim(keySide(conx, mode), be64toh(conx->keyRef[0]), be64toh(conx->keyRef[1]),
+                                         conx->msgLen);
+            return setStatusReply(conx, CONX_KEY_STATUS, (conx->padKey != NULL) ? 'Y' : 'N', 0);
+
+        case CONX_KEY_STATUS:       // Refused keyed messages end the conx
+            if(conx->reply[0] == 'N') {
+                conx->state = CONX_DONE;
+                return -1;
+            }
+            return setNextChunk(conx);
+
+        case CONX_ERROR_REPLY:      // Error status delivered, the conx ends
+            conx->state = CONX_DONE;
+            return -1;
+
+        case CONX_DONE:
+            conx->state = CONX_DONE;
+            return -1;
+    }
+    return -1;
+}
+
+
+/***********************************************************************
+ * Function Name: conxFree
+ * Description: This function releases the buffers held by a conx once
+    the engine is done with it. It does not close the socket, which
+    belongs to the engine, and must be called before the engine does:
+    after an error status the socket is lingered first (see lingerSock),
+    so the request bytes left unread do not turn the close into a reset.
+ **********************************************************************/
+void conxFree(struct Conx* conx)
+{
+    statsCount(STAT_CLOSED, 1);
+    releaseChunkBuffs(conx);
+    if(conx->failed) {
+        lingerSock(conx->sockfd);
+        conx->failed = 0;
+    }
+
+    if(conx->upload != NULL) {      // Conx dropped mid-upload
+        keyUploadAbort(conx->upload);
+        free(conx->upload);
+        conx->upload = NULL;
+    }
+}
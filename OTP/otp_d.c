@@ -0,0 +1,37 @@
+/**********************************************************************************
+ Program Name: otp_d
+ Description: This program is otp_enc_d and otp_dec_d in one daemon. It accepts
+     both otp_enc ('E') and otp_dec ('D') clients on one listener and dispatches
+     each conx (or, for clients that send request headers, each request) to the
+     encryption or decryption kernel its client type names (see servTransform()
+     in otp_serv.c). Encryption and decryption therefore share one process
+     model, one set of workers, conx limits, queue and chunk buffers, so a single
+     pool can be sized for the combined load instead of provisioning two daemons
+     for their separate peaks. otp_enc_d and otp_dec_d are the same server
+     restricted to one client type. Every option of otp_enc_d is accepted (see
+     otp_serv.h); with --keydir, each pad is stored once per side, so otp_enc
+     and otp_dec keep separate watermarks as they would with two daemons (see
+     otp_keystore.h). A client reaches it exactly as it would the dedicated
+     daemon, e.g. otp_enc and otp_dec both given otp_d's port.
+     Syntax: otp_d <listening_port>|--unix <path> [options of otp_enc_d]
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "otp_serv.h"
+
+
+/***********************************************************************
+ * MAIN
+ **********************************************************************/
+int main(int argc, const char * argv[]) {
+    struct ServConfig config;
+    struct ServMode mode = { "otp_d", CLI_ANY, NULL };
+
+    // Read port and process model from the command line
+    parseServArgs(argc, argv, &config);
+
+    runServ(&config, &mode);
+
+    return 0;
+}
@@ -0,0 +1,411 @@
+/**********************************************************************************
+ Module Name: otp_epoll
+ Description: Event-driven I/O engine for the OTP daemons (--io=epoll). A single
+     process multiplexes the listening socket and every client conx through one
+     epoll instance. All sockets are non-blocking; each readiness event moves as
+     many bytes as the socket allows into or out of the conx's current buffer and
+     advances its state machine (otp_conx.c) whenever a step completes. The
+     transform runs inline once a full frame (message and key) has arrived.
+ Reference Citation: http://man7.org/linux/man-pages/man7/epoll.7.html
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#define _GNU_SOURCE     // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "otp_serv.h"
+
+
+// A conx and its place in the loop's expiry list
+struct EpollConx {
+    struct Conx conx;
+    long long armedAt;          // conx.requestStart when last queued on the list
+    struct EpollConx* prev;
+    struct EpollConx* next;
+};
+
+// Event loop state, one per engine process
+struct EpollLoop {
+    int epfd;
+    int servSock;
+    int numConxs;
+    struct EpollConx* head;     // Expiry list, oldest requestStart first
+    struct EpollConx* tail;
+    struct PendingQueue pending;
+    long long acceptPausedAt;   // statsNow() when accepts were paused for lack of fds, else 0
+    struct ServConfig* config;
+    struct ServMode* mode;
+};
+
+// Function Prototypes (local to the engine)
+static void raiseFdLimit(void);
+static void watchListener(struct EpollLoop* loop, int watch);
+static void acceptNewConxs(struct EpollLoop* loop);
+static void startConx(struct EpollLoop* loop, int sockfd);
+static void handleConxEvent(struct EpollLoop* loop, struct EpollConx* epConx);
+static int expireConxs(struct EpollLoop* loop);
+static void listAppend(struct EpollLoop* loop, struct EpollConx* epConx);
+static void listRemove(struct EpollLoop* loop, struct EpollConx* epConx);
+static void closeConx(struct EpollLoop* loop, struct EpollConx* epConx);
+
+
+/***********************************************************************
+ * Function Name: runEpollEngine
+ * Description: This function runs the event loop forever. The listening
+    socket is registered with a NULL data pointer; every other event
+    carries the EpollConx it belongs to. With --workers, several
+    processes share servSock and EPOLLEXCLUSIVE keeps a new conx from
+    waking all of them. epoll_wait() sleeps no longer than the next
+    deadline, and expired conxs are closed after each batch of events.
+    While accepts are paused (see acceptNewConxs()), it also wakes up to
+    retry them after ACCEPT_RETRY_MS.
+ **********************************************************************/
+void runEpollEngine(int servSock, struct ServConfig* config, struct ServMode* mode)
+{
+    int numEvents, i, timeoutMs;
+    long long retryNs;
+    struct EpollLoop loop;
+    struct epoll_event events[EPOLL_EVENTS_MAX];
+
+    raiseFdLimit();
+    fcntl(servSock, F_SETFL, fcntl(servSock, F_GETFL) | O_NONBLOCK);
+
+    memset(&loop, 0, sizeof(loop));
+    loop.servSock = servSock;
+    loop.config = config;
+    loop.mode = mode;
+    pendingInit(&loop.pending, config->queueLen);
+
+    if((loop.epfd = epoll_create1(0)) == -1) {
+        fprintf(stderr, "%s: error from epoll_create1() call.\n", mode->progName);
+        exit(1);
+    }
+
+    watchListener(&loop, 1);
+
+    // Loop forever
+    timeoutMs = -1;
+    while(1)
+    {
+        numEvents = epoll_wait(loop.epfd, events, EPOLL_EVENTS_MAX, timeoutMs);
+        if(numEvents == -1) {
+            if(errno == EINTR) {    // SIGUSR1 may have asked for a stats dump
+                statsPoll();
+                continue;
+            }
+            fprintf(stderr, "%s: error from epoll_wait() call.\n", mode->progName);
+            exit(1);
+        }
+
+        for(i = 0; i < numEvents; i++)
+        {
+            if(events[i].data.ptr == NULL) {
+                acceptNewConxs(&loop);
+            }
+            else {
+                handleConxEvent(&loop, (struct EpollConx*) events[i].data.ptr);
+            }
+        }
+
+        // Only once the batch is done, as closing frees conxs it may name
+        timeoutMs = expireConxs(&loop);
+
+        if(loop.acceptPausedAt != 0) {
+            retryNs = loop.acceptPausedAt + ACCEPT_RETRY_MS * 1000000LL - statsNow();
+            if(retryNs <= 0) {
+                watchListener(&loop, 1);
+            }
+            else if(timeoutMs == -1 || retryNs / 1000000 + 1 < timeoutMs) {
+                timeoutMs = (int) (retryNs / 1000000) + 1;
+            }
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: raiseFdLimit
+ * Description: This function lifts the soft open-file limit to the hard
+    limit, since every conx held by the engine costs one descriptor.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/getrlimit.2.html
+ **********************************************************************/
+static void raiseFdLimit(void)
+{
+    struct rlimit fdLimit;
+
+    if(getrlimit(RLIMIT_NOFILE, &fdLimit) == 0 && fdLimit.rlim_cur < fdLimit.rlim_max) {
+        fdLimit.rlim_cur = fdLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fdLimit);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: watchListener
+ * Description: This function registers the listening socket with the
+    loop's epoll instance (watch 1), or removes it (watch 0) to pause
+    accepts. The listener is level-triggered and registered with
+    EPOLLEXCLUSIVE, which EPOLL_CTL_MOD does not allow, so pausing
+    deletes it and resuming adds it back.
+ **********************************************************************/
+static void watchListener(struct EpollLoop* loop, int watch)
+{
+    struct epoll_event listenEvent;
+
+    if(!watch) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->servSock, NULL);
+        loop->acceptPausedAt = statsNow();
+        return;
+    }
+
+    memset(&listenEvent, 0, sizeof(listenEvent));
+    listenEvent.events = EPOLLIN | EPOLLEXCLUSIVE;
+    listenEvent.data.ptr = NULL;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->servSock, &listenEvent) == -1) {
+        fprintf(stderr, "%s: error from epoll_ctl() call.\n", loop->mode->progName);
+        exit(1);
+    }
+    loop->acceptPausedAt = 0;
+}
+
+
+/***********************************************************************
+ * Function Name: acceptNewConxs
+ * Description: This function accepts every pending conx on the
+    listening socket. Each one is started while the loop is below its
+    conx limit, then queued, and turned away once the queue is full.
+    When the process runs out of descriptors (EMFILE, ENFILE), the
+    connection stays in the backlog and the level-triggered listener
+    would wake the loop again at once, so accepts are paused instead
+    until a conx closes or ACCEPT_RETRY_MS has passed.
+ **********************************************************************/
+static void acceptNewConxs(struct EpollLoop* loop)
+{
+    static int reportedFds = 0;
+    int newClient;
+
+    while((newClient = accept4(loop->servSock, NULL, NULL, SOCK_NONBLOCK)) != -1)
+    {
+        if(loop->config->maxConns == 0 || loop->numConxs < loop->config->maxConns) {
+            startConx(loop, newClient);
+        }
+        else if(pendingPush(&loop->pending, newClient) == -1) {
+            rejectBusy(newClient);
+        }
+    }
+
+    // EAGAIN means the queue is drained; anything else is worth reporting
+    if(errno == EMFILE || errno == ENFILE) {
+        if(!reportedFds) {      // Once, as it recurs every retry while the fds stay used up
+            fprintf(stderr, "%s: out of file descriptors, pausing accept().\n", loop->mode->progName);
+            reportedFds = 1;
+        }
+        watchListener(loop, 0);
+    }
+    else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        fprintf(stderr, "%s: error from accept() call.\n", loop->mode->progName);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: startConx
+ * Description: This function sets up a conx on an accepted socket and
+    registers it for the first read of its state machine.
+ **********************************************************************/
+static void startConx(struct EpollLoop* loop, int sockfd)
+{
+    struct EpollConx* epConx;
+    struct epoll_event conxEvent;
+
+    if((epConx = malloc(sizeof(struct EpollConx))) == NULL) {
+        fprintf(stderr, "%s: out of memory.\n", loop->mode->progName);
+        close(sockfd);
+        return;
+    }
+    conxInit(&epConx->conx, sockfd);
+
+    memset(&conxEvent, 0, sizeof(conxEvent));
+    conxEvent.events = EPOLLIN;
+    conxEvent.data.ptr = epConx;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sockfd, &conxEvent) == -1) {
+        fprintf(stderr, "%s: error from epoll_ctl() call.\n", loop->mode->progName);
+        close(sockfd);
+        conxFree(&epConx->conx);
+        free(epConx);
+        return;
+    }
+    listAppend(loop, epConx);
+    loop->numConxs++;
+}
+
+
+/***********************************************************************
+ * Function Name: handleConxEvent
+ * Description: This function moves bytes for one ready conx until the
+    socket would block, advancing the state machine every time a step
+    completes. If the conx switched between reading and writing, its
+    epoll interest is updated to match. A conx whose deadline restarted
+    moves to the end of the expiry list, which keeps the list sorted.
+ **********************************************************************/
+static void handleConxEvent(struct EpollLoop* loop, struct EpollConx* epConx)
+{
+    struct Conx* conx = &epConx->conx;
+    int wasWrite = conx->isWrite;
+    ssize_t numBytes;
+    struct epoll_event conxEvent;
+
+    while(1)
+    {
+        // Current step complete, move to the next one
+        if(conx->ioDone >= conx->ioLen) {
+            if(conxAdvance(conx, loop->mode) != 0) {
+                closeConx(loop, epConx);
+                return;
+            }
+            continue;
+        }
+
+        if(conx->isWrite) {
+            numBytes = send(conx->sockfd, conx->ioBuff + conx->ioDone,
+                            conx->ioLen - conx->ioDone, MSG_NOSIGNAL);
+        }
+        else {
+            numBytes = recv(conx->sockfd, conx->ioBuff + conx->ioDone,
+                            conx->ioLen - conx->ioDone, 0);
+        }
+
+        if(numBytes > 0) {
+            conx->ioDone += numBytes;
+        }
+        else if(numBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;      // Wait for the next readiness event
+        }
+        else if(numBytes == -1 && errno == EINTR) {
+            continue;
+        }
+        else {          // Peer hung up or errored mid-request
+            closeConx(loop, epConx);
+            return;
+        }
+    }
+
+    if(conx->isWrite != wasWrite) {
+        memset(&conxEvent, 0, sizeof(conxEvent));
+        conxEvent.events = conx->isWrite ? EPOLLOUT : EPOLLIN;
+        conxEvent.data.ptr = epConx;
+        epoll_ctl(loop->epfd, EPOLL_CTL_MOD, conx->sockfd, &conxEvent);
+    }
+
+    if(conx->requestStart != epConx->armedAt) {
+        listRemove(loop, epConx);
+        listAppend(loop, epConx);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: expireConxs
+ * Description: This function closes every conx past its deadline, from
+    the head of the expiry list, and turns away queued conxs that waited
+    too long. Returns the epoll_wait() timeout (ms) until the next
+    deadline, or -1 if nothing is waiting on one.
+ **********************************************************************/
+static int expireConxs(struct EpollLoop* loop)
+{
+    long long now, deadlineNs = loop->config->deadlineNs;
+    long long nextNs, queuedNs;
+
+    if(deadlineNs == 0) {
+        return -1;
+    }
+
+    now = statsNow();
+    while(loop->head != NULL && now - loop->head->conx.requestStart >= deadlineNs)
+    {
+        statsCount(STAT_EXPIRED, 1);
+        closeConx(loop, loop->head);
+    }
+
+    nextNs = (loop->head != NULL) ? loop->head->conx.requestStart + deadlineNs - now : -1;
+    queuedNs = pendingExpire(&loop->pending, deadlineNs);
+    if(nextNs == -1 || (queuedNs != -1 && queuedNs < nextNs)) {
+        nextNs = queuedNs;
+    }
+    return (nextNs == -1) ? -1 : (int) (nextNs / 1000000) + 1;
+}
+
+
+/***********************************************************************
+ * Function Name: listAppend
+ * Description: This helper puts a conx at the end of the expiry list.
+ **********************************************************************/
+static void listAppend(struct EpollLoop* loop, struct EpollConx* epConx)
+{
+    epConx->armedAt = epConx->conx.requestStart;
+    epConx->next = NULL;
+    epConx->prev = loop->tail;
+    if(loop->tail != NULL) {
+        loop->tail->next = epConx;
+    }
+    else {
+        loop->head = epConx;
+    }
+    loop->tail = epConx;
+}
+
+
+/***********************************************************************
+ * Function Name: listRemove
+ * Description: This helper unlinks a conx from the expiry list.
+ **********************************************************************/
+static void listRemove(struct EpollLoop* loop, struct EpollConx* epConx)
+{
+    if(epConx->prev != NULL) {
+        epConx->prev->next = epConx->next;
+    }
+    else {
+        loop->head = epConx->next;
+    }
+    if(epConx->next != NULL) {
+        epConx->next->prev = epConx->prev;
+    }
+    else {
+        loop->tail = epConx->prev;
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: closeConx
+ * Description: This function deregisters and closes a conx and frees
+    everything it holds. The freed place goes to the oldest queued conx,
+    and paused accepts resume now that a descriptor is free.
+ **********************************************************************/
+static void closeConx(struct EpollLoop* loop, struct EpollConx* epConx)
+{
+    int sockfd;
+
+    listRemove(loop, epConx);
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, epConx->conx.sockfd, NULL);
+    conxFree(&epConx->conx);
+    close(epConx->conx.sockfd);
+    free(epConx);
+    loop->numConxs--;
+
+    if(loop->acceptPausedAt != 0) {
+        watchListener(loop, 1);
+    }
+
+    while((loop->config->maxConns == 0 || loop->numConxs < loop->config->maxConns) &&
+          (sockfd = pendingPop(&loop->pending, loop->config->deadlineNs)) != -1) {
+        startConx(loop, sockfd);
+    }
+}
@@ -0,0 +1,292 @@
+/**********************************************************************************
+ Module Name: otp_keystore
+ Description: Daemon-side key pad store. See otp_keystore.h.
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "otp_codec.h"
+#include "otp_keystore.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Pad mapped by this process
+struct MappedPad {
+    unsigned long long keyId;
+    char side;                  // Client type of the copy (otp_d), else 0
+    struct PadHeader* header;   // Start of the shared mapping
+};
+
+static char storeDir[PATH_MAX];     // Empty when the key store is disabled
+static struct MappedPad* mappedPads = NULL;
+static int numMapped = 0, mappedCap = 0;
+static unsigned int uploadCount = 0;
+
+
+/***********************************************************************
+ * Function Name: keyStoreOpen
+ * Description: This function enables the key store, keeping pads in
+    keyDir (created if missing). Returns 0 on success, -1 on error.
+ **********************************************************************/
+int keyStoreOpen(const char* keyDir)
+{
+    if(mkdir(keyDir, 0700) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    if(strlen(keyDir) + 32 >= sizeof(storeDir)) {   // Room for "/<id>.<side>.pad"
+        return -1;
+    }
+    strcpy(storeDir, keyDir);
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: padFileName
+ * Description: This helper writes the path of a stored pad: <id>.pad,
+    or <id>.<side>.pad for one side's copy. Returns 0, or -1 if the path
+    does not fit in pathLen (keyStoreOpen() leaves room for it).
+ **********************************************************************/
+static int padFileName(char* padPath, size_t pathLen, char side, unsigned long long keyId)
+{
+    int pathChars;
+
+    if(side == 0) {
+        pathChars = snprintf(padPath, pathLen, "%s/%016llx.pad", storeDir, keyId);
+    }
+    else {
+        pathChars = snprintf(padPath, pathLen, "%s/%016llx.%c.pad", storeDir, keyId, side);
+    }
+    return (pathChars < 0 || (size_t) pathChars >= pathLen) ? -1 : 0;
+}
+
+
+/***********************************************************************
+ * Function Name: keyStoreEnabled
+ * Description: This function returns 1 if --keydir was given.
+ **********************************************************************/
+int keyStoreEnabled(void)
+{
+    return storeDir[0] != '\0';
+}
+
+
+/***********************************************************************
+ * Function Name: keyUploadBegin
+ * Description: This function opens a temp file in the store for a pad
+    about to be received. Returns 0 on success, -1 on error.
+ **********************************************************************/
+int keyUploadBegin(struct KeyUpload* upload)
+{
+    struct PadHeader header;
+    int pathChars;
+
+    upload->fd = -1;
+    if(!keyStoreEnabled()) {
+        return -1;
+    }
+
+    pathChars = snprintf(upload->tmpPath, sizeof(upload->tmpPath), "%s/.upload.%d.%u",
+                         storeDir, (int) getpid(), uploadCount++);
+    if(pathChars < 0 || (size_t) pathChars >= sizeof(upload->tmpPath)) {
+        return -1;
+    }
+    if((upload->fd = open(upload->tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+        return -1;
+    }
+
+    // Header is filled in once the pad is complete
+    memset(&header, 0, sizeof(header));
+    if(pwrite(upload->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        keyUploadAbort(upload);
+        return -1;
+    }
+    upload->hash = FNV_OFFSET_BASIS;
+    upload->padLen = 0;
+    upload->badChars = 0;
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: keyUploadWrite
+ * Description: This function appends a chunk of pad chars to an open
+    upload, hashing and validating them on the way. Returns 0 on
+    success, -1 if the write failed.
+ **********************************************************************/
+int keyUploadWrite(struct KeyUpload* upload, const char* data, int len)
+{
+    int i;
+
+    if(findBadChar(data, (size_t) len) != (size_t) len) {
+        upload->badChars = 1;
+    }
+    for(i = 0; i < len; i++) {
+        upload->hash = (upload->hash ^ (unsigned char) data[i]) * FNV_PRIME;
+    }
+
+    if(pwrite(upload->fd, data, len, PAD_HEADER_SIZE + upload->padLen) != len) {
+        return -1;
+    }
+    upload->padLen += len;
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: samePad
+ * Description: This helper tells whether two pad files hold the same
+    pad chars. IDs are FNV-1a hashes, which are easy to collide on
+    purpose, so an ID match alone does not prove the pads equal.
+ **********************************************************************/
+static int samePad(const char* padPath, const char* otherPath)
+{
+    struct PadHeader *pad, *other;
+    size_t padMapLen, otherMapLen;
+    int same;
+
+    if((pad = padMap(padPath, &padMapLen)) == NULL) {
+        return 0;
+    }
+    if((other = padMap(otherPath, &otherMapLen)) == NULL) {
+        munmap(pad, padMapLen);
+        return 0;
+    }
+    same = (pad->padLen == other->padLen &&
+            memcmp((char*) pad + PAD_HEADER_SIZE, (char*) other + PAD_HEADER_SIZE, pad->padLen) == 0);
+    munmap(pad, padMapLen);
+    munmap(other, otherMapLen);
+    return same;
+}
+
+
+/***********************************************************************
+ * Function Name: keyUploadFinish
+ * Description: This function completes an upload: the header is written
+    and the temp file linked in as <id>.pad. If that pad is already
+    stored the existing file (and its watermark) is kept. A different
+    pad with the same ID is refused rather than mapped to the stored
+    one. Returns 0 and the pad's ID on success, -1 for an empty, invalid
+    or colliding pad. The pad is stored as side's copy (see
+    otp_keystore.h).
+ **********************************************************************/
+int keyUploadFinish(struct KeyUpload* upload, char side, unsigned long long* keyId)
+{
+    struct PadHeader header;
+    char padPath[PATH_MAX];
+
+    if(upload->badChars || upload->padLen == 0) {
+        keyUploadAbort(upload);
+        return -1;
+    }
+
+    padInitHeader(&header, (upload->hash == 0) ? 1 : upload->hash, upload->padLen);     // 0 is never an ID
+
+    if(pwrite(upload->fd, &header, sizeof(header), 0) != sizeof(header) || fsync(upload->fd) == -1) {
+        keyUploadAbort(upload);
+        return -1;
+    }
+
+    // link() fails with EEXIST when the pad is already stored, which keeps its watermark
+    if(padFileName(padPath, sizeof(padPath), side, header.keyId) == -1) {
+        keyUploadAbort(upload);
+        return -1;
+    }
+    if(link(upload->tmpPath, padPath) == -1 &&
+       (errno != EEXIST || !samePad(padPath, upload->tmpPath))) {
+        keyUploadAbort(upload);
+        return -1;
+    }
+    keyUploadAbort(upload);     // Drop the temp name
+
+    *keyId = header.keyId;
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: keyUploadAbort
+ * Description: This function closes and removes an upload's temp file.
+ **********************************************************************/
+void keyUploadAbort(struct KeyUpload* upload)
+{
+    if(upload->fd != -1) {
+        close(upload->fd);
+        unlink(upload->tmpPath);
+        upload->fd = -1;
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: findPad
+ * Description: This helper returns the header of a stored pad, mapping
+    its file on first use. Mappings are kept for the life of the
+    process. Returns NULL if the pad is unknown or corrupt.
+ **********************************************************************/
+static struct PadHeader* findPad(char side, unsigned long long keyId)
+{
+    char padPath[PATH_MAX];
+    struct PadHeader* header;
+    struct MappedPad* grown;
+    size_t mapLen;
+    int i, newCap;
+
+    for(i = 0; i < numMapped; i++) {
+        if(mappedPads[i].keyId == keyId && mappedPads[i].side == side) {
+            return mappedPads[i].header;
+        }
+    }
+
+    if(padFileName(padPath, sizeof(padPath), side, keyId) == -1 ||
+       (header = padMap(padPath, &mapLen)) == NULL) {
+        return NULL;
+    }
+    if(header->keyId != keyId) {
+        munmap(header, mapLen);
+        return NULL;
+    }
+
+    if(numMapped == mappedCap) {    // Double capacity when full
+        newCap = (mappedCap == 0) ? 16 : 2 * mappedCap;
+        if((grown = realloc(mappedPads, newCap * sizeof(struct MappedPad))) == NULL) {
+            munmap(header, mapLen);
+            return NULL;
+        }
+        mappedPads = grown;
+        mappedCap = newCap;
+    }
+    mappedPads[numMapped].keyId = keyId;
+    mappedPads[numMapped].side = side;
+    mappedPads[numMapped].header = header;
+    numMapped++;
+    return header;
+}
+
+
+/***********************************************************************
+ * Function Name: keyStoreClaim
+ * Description: This function consumes pad chars [offset, offset + len)
+    of side's copy of a stored pad. The range must lie within the pad
+    and start at or after the watermark; any chars skipped before offset
+    are consumed too. Returns the first claimed pad char, or NULL if the pad is
+    unknown or the range is unavailable.
+ **********************************************************************/
+const char* keyStoreClaim(char side, unsigned long long keyId, unsigned long long offset, unsigned long long len)
+{
+    struct PadHeader* header;
+
+    if(!keyStoreEnabled() || (header = findPad(side, keyId)) == NULL || offset == PAD_NEXT) {
+        return NULL;
+    }
+    return padClaim(header, &offset, len);
+}
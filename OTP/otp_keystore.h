@@ -0,0 +1,45 @@
+#ifndef otp_keystore_h
+#define otp_keystore_h
+/**********************************************************************************
+ Module Name: otp_keystore
+ Description: Daemon-side store of key pads, enabled with --keydir <dir>. A client
+     uploads a pad once and gets back its key ID (a 64-bit FNV-1a hash of the pad,
+     so otp_enc_d and otp_dec_d given the same pad agree on its ID, and uploading
+     a pad again returns the existing one). Later requests name the ID and an
+     offset instead of shipping the key.
+     Each pad is one file <dir>/<id>.pad in the pad file format (see otp_pad.h).
+     Files are memory-mapped MAP_SHARED, so every process of the daemon (forked
+     children, pool workers) sees the same header. A request for [offset,
+     offset + len) is only granted when offset >= the pad's watermark, which is
+     then moved past it atomically. Key chars are therefore never reused, even
+     by concurrent requests in different processes.
+     The unified daemon otp_d serves both client types from one store, so it
+     keeps a copy of each pad per side (<dir>/<id>.<E|D>.pad): otp_enc and
+     otp_dec each upload and consume their own copy, with its own watermark,
+     as they would with two daemons. The other daemons pass side 0.
+ Reference Citation: http://man7.org/linux/man-pages/man2/mmap.2.html
+ Reference Citation: http://www.isthe.com/chongo/tech/comp/fnv/index.html
+ *********************************************************************************/
+
+#include <limits.h>
+#include "otp_pad.h"
+
+// Pad being received from a client
+struct KeyUpload {
+    int fd;                         // Temp file, -1 when no upload is open
+    char tmpPath[PATH_MAX];
+    unsigned long long hash;        // Running FNV-1a hash of the pad
+    unsigned long long padLen;
+    int badChars;                   // Set when the pad holds a non-alphabet char
+};
+
+// Function Prototypes
+int keyStoreOpen(const char* keyDir);
+int keyStoreEnabled(void);
+int keyUploadBegin(struct KeyUpload* upload);
+int keyUploadWrite(struct KeyUpload* upload, const char* data, int len);
+int keyUploadFinish(struct KeyUpload* upload, char side, unsigned long long* keyId);
+void keyUploadAbort(struct KeyUpload* upload);
+const char* keyStoreClaim(char side, unsigned long long keyId, unsigned long long offset, unsigned long long len);
+
+#endif
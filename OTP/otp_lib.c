@@ -0,0 +1,726 @@
+/**********************************************************************************
+ Module Name: otp_lib (libotp)
+ Description: In-process client library of the OTP daemons. See otp_lib.h.
+     A pool keeps its idle conxs on a stack guarded by one mutex; the socket
+     I/O of a request runs outside the lock, so threads only contend to borrow
+     and return conxs. Conxs are header conxs (see otp_proto.h): a request is
+     its header and first chunk in one write, with no handshake. Each chunk
+     is sent (message, then key, in one write) and its result read back before
+     the next chunk is sent, which needs no extra buffering and cannot
+     deadlock however small the socket buffers are.
+     An OtpShm instead keeps every slot of its ring busy: it fills free slots
+     while the daemon works on earlier ones, and copies results out in ring
+     order as they complete.
+ Reference Citation: http://man7.org/linux/man-pages/man7/pthreads.7.html
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#define _GNU_SOURCE     // memfd_create(), F_ADD_SEALS
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "otp_proto.h"
+#include "otp_ring.h"
+#include "otp_lib.h"
+
+// Conxs to one daemon, shared by the application's threads
+struct OtpPool {
+    char cliType;           // OTP_ENCRYPT or OTP_DECRYPT
+    int port;
+    char* unixPath;         // Daemon's unix domain socket, else NULL
+    int maxConxs;
+    int numOpen;            // Conxs open or being opened (idle or borrowed)
+    int numIdle;
+    int* idleSocks;         // Stack of idle conxs, maxConxs long
+    pthread_mutex_t lock;
+    pthread_cond_t returned;    // Signalled whenever a conx slot frees up
+};
+
+// Shared-memory ring attached to one daemon
+struct OtpShm {
+    int ctrlSock;           // Control socket; the daemon hangs it up when it goes
+    struct RingHeader* header;
+    size_t mapLen;
+    unsigned int numSlots;
+    unsigned int submitted;     // Client's copy of header->submitted
+    unsigned int completed;     // Slots already copied out
+    int broken;             // Set once the session failed; every later call fails
+    pthread_mutex_t lock;   // One transform at a time uses the ring
+};
+
+
+/***********************************************************************
+ * Function Name: otpConnect
+ * Description: This function connects a socket to the daemon on the
+    loopback port, or on unixPath if it is not NULL. Returns the socket,
+    or OTP_ECONNECT (errno tells why).
+ **********************************************************************/
+int otpConnect(int port, const char* unixPath)
+{
+    int sockfd;
+    int optval = 1;
+    struct sockaddr_in servAddress;
+    struct sockaddr_un unixAddress;
+
+    if(unixPath != NULL)
+    {
+        // Setup server info (path of the daemon's socket file)
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        strncpy(unixAddress.sun_path, unixPath, sizeof(unixAddress.sun_path) - 1);
+
+        if((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+            return OTP_ECONNECT;
+        }
+        if(connect(sockfd, (struct sockaddr*) &unixAddress, sizeof(unixAddress)) == -1) {
+            close(sockfd);
+            return OTP_ECONNECT;
+        }
+        return sockfd;
+    }
+
+    // Setup server info (the daemons serve the local host)
+    memset(&servAddress, 0, sizeof(servAddress));
+    servAddress.sin_family = AF_INET;   // IPv4
+    servAddress.sin_port = htons(port);     // Store port (converting to big endian)
+    servAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if((sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        return OTP_ECONNECT;
+    }
+
+    // Set SO_REUSEADDR Socket Option to avoid "Address already in use" error
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    // Disable Nagle so a chunk is not held back waiting for the ACK of the last one
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    if(connect(sockfd, (struct sockaddr*) &servAddress, sizeof(servAddress)) == -1) {
+        close(sockfd);
+        return OTP_ECONNECT;
+    }
+    return sockfd;
+}
+
+
+/***********************************************************************
+ * Function Name: otpMakeHeader
+ * Description: This function fills in a request header (see otp_proto.h)
+    in network byte order. keyId and keyOffset only matter for
+    OP_KEYED_MESSAGE.
+ **********************************************************************/
+void otpMakeHeader(struct ReqHeader* header, char cliType, int op, unsigned long long len, int flags,
+                   unsigned long long keyId, unsigned long long keyOffset)
+{
+    header->magic = htobe32(HDR_MAGIC);
+    header->version = HDR_VERSION;
+    header->cliType = (unsigned char) cliType;
+    header->op = (unsigned char) op;
+    header->flags = (unsigned char) flags;
+    header->length = htobe64(len);
+    header->keyId = htobe64(keyId);
+    header->keyOffset = htobe64(keyOffset);
+}
+
+
+/***********************************************************************
+ * Function Name: otpStatusError
+ * Description: This function returns the OTP_E* code of the status
+    char that followed a REPLY_ERROR.
+ **********************************************************************/
+int otpStatusError(char status)
+{
+    switch(status)
+    {
+        case STATUS_REFUSED:    return OTP_EREJECTED;
+        case STATUS_BUSY:       return OTP_EBUSY;
+        case STATUS_VERSION:    return OTP_EVERSION;
+        case STATUS_KEY:        return OTP_EKEY;
+        default:                return OTP_EIO;
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: sendPieces
+ * Description: This helper sends every byte of the given pieces with
+    as few sendmsg() calls as the socket allows, so a header and the
+    chunk behind it leave in one segment. Returns 0, or -1 if the conx
+    failed.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/sendmsg.2.html
+ **********************************************************************/
+static int sendPieces(int sockfd, struct iovec* pieces, int numPieces)
+{
+    struct msghdr msg;
+    ssize_t bytesSent;
+
+    while(numPieces > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = pieces;
+        msg.msg_iovlen = numPieces;
+        bytesSent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if(bytesSent == -1 && errno == EINTR) {
+            continue;
+        }
+        if(bytesSent == -1) {
+            return -1;
+        }
+        while(numPieces > 0 && (size_t) bytesSent >= pieces->iov_len) {    // Skip what was sent
+            bytesSent -= pieces->iov_len;
+            pieces++;
+            numPieces--;
+        }
+        if(numPieces > 0) {
+            pieces->iov_base = (char*) pieces->iov_base + bytesSent;
+            pieces->iov_len -= bytesSent;
+        }
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: recvResult
+ * Description: This helper reads one transformed chunk. The first chunk
+    of a request may instead be an error status, which no result can
+    start with, or the plain busy reply of a daemon that turned the conx
+    away before its header arrived. Returns 0 or an OTP_E* code.
+ **********************************************************************/
+static int recvResult(int sockfd, char* outBuff, size_t len, int first)
+{
+    long long bytesRcvd = otpRecvAll(sockfd, outBuff, len);
+    char status = 0;
+
+    if(first && bytesRcvd > 0 && outBuff[0] == REPLY_ERROR) {
+        if(bytesRcvd > 1) {
+            status = outBuff[1];
+        }
+        else {
+            otpRecvAll(sockfd, &status, sizeof(status));
+        }
+        return otpStatusError(status);
+    }
+    if(first && bytesRcvd == 1 && len > 1 && outBuff[0] == PERM_BUSY) {    // Busy before the header arrived
+        return OTP_EBUSY;
+    }
+    return (bytesRcvd == (long long) len) ? 0 : OTP_EIO;
+}
+
+
+/***********************************************************************
+ * Function Name: otpRequest
+ * Description: This function runs one message request on a conx: the
+    header goes out with the first chunk of message and key in one
+    write, and each transformed chunk is read into outBuff before the
+    next chunk is sent. No handshake is needed, so this may be the
+    first request of a new conx. Returns 0 or an OTP_E* code; the conx
+    is unusable after any error.
+ **********************************************************************/
+int otpRequest(int sockfd, char cliType, const char* data, const char* key, char* outBuff, size_t len)
+{
+    struct ReqHeader header;
+    struct iovec pieces[3];
+    size_t done = 0, chunkLen;
+    int numPieces, err;
+
+    otpMakeHeader(&header, cliType, OP_MESSAGE, len, 0, 0, 0);
+    do
+    {
+        chunkLen = (len - done < CHUNK_SIZE) ? len - done : CHUNK_SIZE;
+        numPieces = 0;
+        if(done == 0) {
+            pieces[numPieces].iov_base = &header;
+            pieces[numPieces++].iov_len = HDR_SIZE;
+        }
+        pieces[numPieces].iov_base = (char*) data + done;
+        pieces[numPieces++].iov_len = chunkLen;
+        pieces[numPieces].iov_base = (char*) key + done;
+        pieces[numPieces++].iov_len = chunkLen;
+        if(sendPieces(sockfd, pieces, numPieces) == -1) {
+            return OTP_EIO;
+        }
+        if(chunkLen > 0 && (err = recvResult(sockfd, outBuff + done, chunkLen, done == 0)) != 0) {
+            return err;
+        }
+        done += chunkLen;
+    } while(done < len);
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: otpSendAll
+ * Description: This function sends all len bytes, waiting for buffer
+    space if the socket is non-blocking. Returns 0 on success, -1 if
+    the conx failed (errno tells why).
+ * Reference Citation: http://man7.org/linux/man-pages/man2/send.2.html
+ **********************************************************************/
+int otpSendAll(int sockfd, const char* dataToSend, size_t len)
+{
+    ssize_t bytesSent;          // Bytes taken by last send() call
+    struct pollfd sendReady;
+
+    while(len > 0)
+    {
+        bytesSent = send(sockfd, dataToSend, len, MSG_NOSIGNAL);
+        if(bytesSent > 0) {
+            dataToSend += bytesSent;    // Skip past what was sent
+            len -= bytesSent;
+        }
+        else if(bytesSent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            sendReady.fd = sockfd;      // Sleep until there is buffer space
+            sendReady.events = POLLOUT;
+            poll(&sendReady, 1, -1);
+        }
+        else if(bytesSent == -1 && errno == EINTR) {
+            continue;
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: otpRecvAll
+ * Description: This function loops on recv() until len bytes arrived.
+    Returns the number of bytes received (less than len on EOF/error).
+ * Reference Citation: http://man7.org/linux/man-pages/man2/recv.2.html
+ **********************************************************************/
+long long otpRecvAll(int sockfd, char* msgBuff, size_t len)
+{
+    size_t bytesToRecv = len;   // Expected  bytes to be received
+    ssize_t bytesRcvd;          // Bytes read by last recv() call
+
+    while(bytesToRecv > 0)
+    {
+        bytesRcvd = recv(sockfd, msgBuff, bytesToRecv, 0);
+        if(bytesRcvd > 0) {
+            msgBuff += bytesRcvd;       // Add bytes to cumulative buffer
+            bytesToRecv -= bytesRcvd;   // Adjust the # of bytes still expected
+        }
+        else if(!(bytesRcvd == -1 && errno == EINTR)) {
+            break;
+        }
+    }
+    return (long long) (len - bytesToRecv);
+}
+
+
+/***********************************************************************
+ * Function Name: otpPoolOpen
+ * Description: This function creates a pool of up to maxConxs conxs to
+    the daemon of the given client type, on the loopback port or on
+    unixPath if it is not NULL. No conx is opened until it is needed.
+    Returns the pool, or NULL on a bad argument or out of memory.
+ **********************************************************************/
+struct OtpPool* otpPoolOpen(char cliType, int port, const char* unixPath, int maxConxs)
+{
+    struct OtpPool* pool;
+
+    if((cliType != OTP_ENCRYPT && cliType != OTP_DECRYPT) ||
+       maxConxs < 1 || maxConxs > OTP_POOL_CONXS_MAX) {
+        return NULL;
+    }
+    if((pool = calloc(1, sizeof(struct OtpPool))) == NULL) {
+        return NULL;
+    }
+    pool->cliType = cliType;
+    pool->port = port;
+    pool->maxConxs = maxConxs;
+    pool->idleSocks = malloc(maxConxs * sizeof(int));
+    pool->unixPath = (unixPath != NULL) ? strdup(unixPath) : NULL;
+    if(pool->idleSocks == NULL || (unixPath != NULL && pool->unixPath == NULL)) {
+        free(pool->idleSocks);
+        free(pool->unixPath);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->returned, NULL);
+
+    selectCodec(NULL);      // Pick the codec kernels now, not racing in threads
+    return pool;
+}
+
+
+/***********************************************************************
+ * Function Name: borrowConx
+ * Description: This helper takes an idle conx from the pool, or opens a
+    new one while the pool is under maxConxs, else waits for one to be
+    returned. With fresh set, a new conx is always opened (closing an
+    idle one to make room if need be), since the idle ones are likely as
+    stale as the one that just failed. *reused tells whether the conx
+    was idle in the pool. Returns the socket or an OTP_E* code.
+ **********************************************************************/
+static int borrowConx(struct OtpPool* pool, int fresh, int* reused)
+{
+    int sockfd;
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->numIdle == 0 && pool->numOpen == pool->maxConxs) {
+        pthread_cond_wait(&pool->returned, &pool->lock);
+    }
+    if(fresh && pool->numIdle > 0 && pool->numOpen == pool->maxConxs) {
+        close(pool->idleSocks[--pool->numIdle]);
+        pool->numOpen--;
+    }
+    if(pool->numIdle > 0 && !fresh) {
+        sockfd = pool->idleSocks[--pool->numIdle];
+        pthread_mutex_unlock(&pool->lock);
+        *reused = 1;
+        return sockfd;
+    }
+    pool->numOpen++;        // Claim the slot, connect outside the lock
+    pthread_mutex_unlock(&pool->lock);
+
+    *reused = 0;
+    if((sockfd = otpConnect(pool->port, pool->unixPath)) < 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->numOpen--;
+        pthread_cond_signal(&pool->returned);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return sockfd;
+}
+
+
+/***********************************************************************
+ * Function Name: returnConx
+ * Description: This helper gives a borrowed conx back to the pool, or
+    closes it if it failed (keep is 0).
+ **********************************************************************/
+static void returnConx(struct OtpPool* pool, int sockfd, int keep)
+{
+    if(!keep) {
+        close(sockfd);
+    }
+    pthread_mutex_lock(&pool->lock);
+    if(keep) {
+        pool->idleSocks[pool->numIdle++] = sockfd;
+    }
+    else {
+        pool->numOpen--;
+    }
+    pthread_cond_signal(&pool->returned);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/***********************************************************************
+ * Function Name: otpPoolTransform
+ * Description: This function has the pool's daemon transform len chars
+    of data with as many chars of key, writing the result to outBuff
+    (which must not overlap data or key). Safe to call from any number
+    of threads. Returns 0 or an OTP_E* code.
+ **********************************************************************/
+int otpPoolTransform(struct OtpPool* pool, const char* data, const char* key, char* outBuff, size_t len)
+{
+    int sockfd, reused, attempt, err = OTP_EIO;
+
+    if(pool == NULL || (len > 0 && (data == NULL || key == NULL || outBuff == NULL)) ||
+       len > OP_LEN_MASK) {
+        return OTP_EINVAL;
+    }
+    if(findBadChar(data, len) != len || findBadChar(key, len) != len) {
+        return OTP_EBADCHAR;
+    }
+    if(len == 0) {
+        return 0;
+    }
+
+    // A conx from the pool may have gone stale; then retry once on a new one
+    for(attempt = 0; attempt < 2; attempt++)
+    {
+        if((sockfd = borrowConx(pool, attempt > 0, &reused)) < 0) {
+            return sockfd;
+        }
+        if((err = otpRequest(sockfd, pool->cliType, data, key, outBuff, len)) == 0) {
+            returnConx(pool, sockfd, 1);
+            return 0;
+        }
+        returnConx(pool, sockfd, 0);
+        if(!reused || err != OTP_EIO) {
+            break;
+        }
+    }
+    return err;
+}
+
+
+/***********************************************************************
+ * Function Name: otpPoolClose
+ * Description: This function closes every conx of the pool and frees
+    it. No thread may be using the pool any more.
+ **********************************************************************/
+void otpPoolClose(struct OtpPool* pool)
+{
+    if(pool == NULL) {
+        return;
+    }
+    while(pool->numIdle > 0) {
+        close(pool->idleSocks[--pool->numIdle]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->returned);
+    free(pool->idleSocks);
+    free(pool->unixPath);
+    free(pool);
+}
+
+
+/***********************************************************************
+ * Function Name: sendRingFd
+ * Description: This helper sends the client type char with the ring's
+    memfd attached, then reads the daemon's reply. Returns 0 or an
+    OTP_E* code.
+ * Reference Citation: http://man7.org/linux/man-pages/man3/cmsg.3.html
+ **********************************************************************/
+static int sendRingFd(int ctrlSock, char cliType, int ringFd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    union {                 // Aligns the buffer for struct cmsghdr
+        char buff[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } cmsgBuff;
+    char permToConnect;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cmsgBuff, 0, sizeof(cmsgBuff));
+    iov.iov_base = &cliType;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgBuff.buff;
+    msg.msg_controllen = sizeof(cmsgBuff.buff);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ringFd, sizeof(int));
+
+    if(sendmsg(ctrlSock, &msg, MSG_NOSIGNAL) != 1 ||
+       otpRecvAll(ctrlSock, &permToConnect, sizeof(permToConnect)) < 1) {
+        return OTP_EIO;
+    }
+    if(permToConnect == PERM_BUSY) {
+        return OTP_EBUSY;
+    }
+    return (permToConnect == 'Y') ? 0 : OTP_EREJECTED;
+}
+
+
+/***********************************************************************
+ * Function Name: otpShmOpen
+ * Description: This function creates a ring of RING_SLOTS_DEFAULT slots
+    in a sealed memfd and attaches it to the daemon of the given client
+    type through its --shm control socket at path. On success *shm is
+    set. Returns 0 or an OTP_E* code (errno is left set for OTP_ESYS).
+ * Reference Citation: http://man7.org/linux/man-pages/man2/memfd_create.2.html
+ **********************************************************************/
+int otpShmOpen(char cliType, const char* path, struct OtpShm** shm)
+{
+    struct OtpShm* newShm;
+    int ringFd, err;
+
+    if((cliType != OTP_ENCRYPT && cliType != OTP_DECRYPT) || path == NULL || shm == NULL) {
+        return OTP_EINVAL;
+    }
+    if((newShm = calloc(1, sizeof(struct OtpShm))) == NULL) {
+        return OTP_ENOMEM;
+    }
+    newShm->numSlots = RING_SLOTS_DEFAULT;
+    newShm->mapLen = RING_SIZE(newShm->numSlots);
+
+    // Size the memfd, then seal it so the daemon's mapping cannot fault
+    ringFd = memfd_create("otp_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(ringFd == -1 || ftruncate(ringFd, newShm->mapLen) == -1 ||
+       fcntl(ringFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1 ||
+       (newShm->header = mmap(NULL, newShm->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                              ringFd, 0)) == MAP_FAILED) {
+        err = errno;
+        if(ringFd != -1) {
+            close(ringFd);
+        }
+        free(newShm);
+        errno = err;
+        return (err == ENOMEM) ? OTP_ENOMEM : OTP_ESYS;
+    }
+    newShm->header->magic = RING_MAGIC;
+    newShm->header->numSlots = newShm->numSlots;
+
+    if((newShm->ctrlSock = otpConnect(0, path)) < 0) {
+        err = OTP_ECONNECT;
+    }
+    else if((err = sendRingFd(newShm->ctrlSock, cliType, ringFd)) != 0) {
+        close(newShm->ctrlSock);
+    }
+    close(ringFd);      // The mappings keep the memfd alive
+    if(err != 0) {
+        munmap(newShm->header, newShm->mapLen);
+        free(newShm);
+        return err;
+    }
+
+    pthread_mutex_init(&newShm->lock, NULL);
+    *shm = newShm;
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: daemonGone
+ * Description: This helper tells whether the daemon hung up the control
+    socket (the session process exited).
+ **********************************************************************/
+static int daemonGone(struct OtpShm* shm)
+{
+    struct pollfd ctrlReady;
+
+    ctrlReady.fd = shm->ctrlSock;
+    ctrlReady.events = POLLIN;      // The daemon never sends after its reply, so this is EOF
+    return poll(&ctrlReady, 1, 0) != 0;
+}
+
+
+/***********************************************************************
+ * Function Name: shmTransform
+ * Description: This helper streams len chars through the ring: free
+    slots are filled with the next chunks of data and key, and each
+    completed slot's result is copied to outBuff, until every chunk came
+    back. Returns 0 or OTP_EIO. The caller holds the lock.
+ **********************************************************************/
+static int shmTransform(struct OtpShm* shm, const char* data, const char* key, char* outBuff, size_t len)
+{
+    struct RingHeader* header = shm->header;
+    struct RingSlot* slot;
+    size_t sent = 0, received = 0, chunkLen;
+    unsigned int completed;
+
+    while(received < len)
+    {
+        // Fill every free slot
+        while(sent < len && shm->submitted - shm->completed < shm->numSlots)
+        {
+            slot = RING_SLOT(header, shm->submitted % shm->numSlots);
+            chunkLen = (len - sent < RING_SLOT_CHARS) ? len - sent : RING_SLOT_CHARS;
+            slot->len = chunkLen;
+            memcpy(slot->data, data + sent, chunkLen);
+            memcpy(slot->key, key + sent, chunkLen);
+            sent += chunkLen;
+            ringPublish(&header->submitted, ++shm->submitted, &header->daemonWaiting);
+        }
+
+        // Wait for the oldest slot in flight, checking on the daemon now and then
+        completed = ringWait(&header->completed, shm->completed, &header->clientWaiting, RING_POLL_MS);
+        if(completed == shm->completed) {
+            if(daemonGone(shm)) {
+                return OTP_EIO;
+            }
+            continue;
+        }
+        if(completed - shm->completed > shm->submitted - shm->completed) {
+            return OTP_EIO;     // The daemon completed slots never submitted
+        }
+
+        while(shm->completed != completed)
+        {
+            slot = RING_SLOT(header, shm->completed % shm->numSlots);
+            chunkLen = (len - received < RING_SLOT_CHARS) ? len - received : RING_SLOT_CHARS;
+            memcpy(outBuff + received, slot->data, chunkLen);
+            received += chunkLen;
+            shm->completed++;
+        }
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: otpShmTransform
+ * Description: This function has the daemon transform len chars of data
+    with as many chars of key through the shm ring, writing the result
+    to outBuff (which may be data itself). Calls from several threads
+    take turns on the ring. Returns 0 or an OTP_E* code; after OTP_EIO
+    the session is dead and must be closed.
+ **********************************************************************/
+int otpShmTransform(struct OtpShm* shm, const char* data, const char* key, char* outBuff, size_t len)
+{
+    int err;
+
+    if(shm == NULL || (len > 0 && (data == NULL || key == NULL || outBuff == NULL))) {
+        return OTP_EINVAL;
+    }
+    if(findBadChar(data, len) != len || findBadChar(key, len) != len) {
+        return OTP_EBADCHAR;
+    }
+    if(len == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&shm->lock);
+    err = shm->broken ? OTP_EIO : shmTransform(shm, data, key, outBuff, len);
+    if(err != 0) {
+        shm->broken = 1;
+    }
+    pthread_mutex_unlock(&shm->lock);
+    return err;
+}
+
+
+/***********************************************************************
+ * Function Name: otpShmClose
+ * Description: This function detaches the ring from the daemon and
+    frees it. No thread may be using the session any more.
+ **********************************************************************/
+void otpShmClose(struct OtpShm* shm)
+{
+    if(shm == NULL) {
+        return;
+    }
+    __atomic_store_n(&shm->header->closed, 1, __ATOMIC_RELEASE);
+    close(shm->ctrlSock);       // Wakes the daemon's next liveness check
+    munmap(shm->header, shm->mapLen);
+    pthread_mutex_destroy(&shm->lock);
+    free(shm);
+}
+
+
+/***********************************************************************
+ * Function Name: otpStrError
+ * Description: This function describes an OTP_E* code.
+ **********************************************************************/
+const char* otpStrError(int err)
+{
+    switch(err)
+    {
+        case 0:             return "Success";
+        case OTP_ECONNECT:  return "Cannot connect to the daemon";
+        case OTP_EREJECTED: return "Daemon refused the client (wrong daemon type)";
+        case OTP_EBUSY:     return "Daemon is busy, try again later";
+        case OTP_EIO:       return "Conx to the daemon failed mid-request";
+        case OTP_EBADCHAR:  return "Input contains bad characters";
+        case OTP_EINVAL:    return "Invalid argument";
+        case OTP_ENOMEM:    return "Out of memory";
+        case OTP_ESYS:      return "System call failed (see errno)";
+        case OTP_EVERSION:  return "Daemon does not speak this protocol version";
+        case OTP_EKEY:      return "Key store refused the request";
+        default:            return "Unknown error";
+    }
+}
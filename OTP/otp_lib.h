@@ -0,0 +1,85 @@
+#ifndef otp_lib_h
+#define otp_lib_h
+/**********************************************************************************
+ Module Name: otp_lib (libotp)
+ Description: In-process client library of the OTP daemons, so an application
+     can encrypt or decrypt buffers without spawning otp_enc or otp_dec. The
+     library is built as libotp.a (see compileall) out of this module and the
+     codec (otp_codec.h, whose kernels can also be called directly to transform
+     locally); link it with -pthread.
+     An OtpPool talks to one daemon (otp_enc_d for OTP_ENCRYPT, otp_dec_d for
+     OTP_DECRYPT) over at most maxConxs keep-alive conxs. otpPoolTransform() is
+     buffer in, buffer out: it borrows an idle conx (connecting a new one while
+     under maxConxs, else waiting for one to be returned), streams the message
+     and key in chunks and reads the result into the caller's buffer. A pool
+     may be shared by any number of threads, each conx serving one of them at
+     a time. Keep maxConxs within the conxs the daemon serves at once: a blocking
+     pool worker is held by one keep-alive conx until it closes, so conxs beyond
+     --workers N would sit unserved (event-driven daemons have no such limit).
+     Transforms are idempotent, so a request that fails on a conx
+     reused from the pool (e.g. one the daemon closed at its --deadline) is
+     retried once on a fresh conx. Nothing is printed and nothing exits;
+     every call returns 0 or a negative OTP_E* code (see otpStrError()).
+     A daemon run with --shm <path> also serves clients on the same host
+     through shared memory: otpShmOpen() hands it a ring (see otp_ring.h)
+     that otpShmTransform() fills with chunks for the daemon to transform in
+     place, so the payload never passes through a socket. A session is one
+     ring and serves its threads one call at a time; open one per thread for
+     parallel transforms.
+     The lower-level otpConnect(), otpMakeHeader(), otpStatusError(),
+     otpSendAll() and otpRecvAll() are the primitives otp_enc and otp_dec are
+     built on; otpRequest() runs one request on a conx of the caller's own.
+     Example:
+         struct OtpPool* pool = otpPoolOpen(OTP_ENCRYPT, port, NULL, 8);
+         int err = otpPoolTransform(pool, plain, key, cipher, len);
+         ...
+         otpPoolClose(pool);
+
+         struct OtpShm* shm;
+         int err = otpShmOpen(OTP_ENCRYPT, shmPath, &shm);
+         err = otpShmTransform(shm, plain, key, cipher, len);
+         ...
+         otpShmClose(shm);
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <stddef.h>
+#include "otp_proto.h"
+#include "otp_codec.h"
+
+#define OTP_ENCRYPT 'E'     // Client types (the handshake char, see otp_proto.h)
+#define OTP_DECRYPT 'D'
+#define OTP_POOL_CONXS_MAX 1024     // Upper bound for maxConxs
+
+// Error codes (all negative)
+#define OTP_ECONNECT   -1   // Daemon could not be reached
+#define OTP_EREJECTED  -2   // Daemon refused the client type (wrong daemon)
+#define OTP_EBUSY      -3   // Daemon turned the conx away as busy
+#define OTP_EIO        -4   // Conx failed mid-request
+#define OTP_EBADCHAR   -5   // Message or key has a char outside A-Z and space
+#define OTP_EINVAL     -6   // Bad argument
+#define OTP_ENOMEM     -9   // Out of memory
+#define OTP_ESYS       -10  // System call failed (errno tells which error)
+#define OTP_EVERSION   -7   // Daemon does not accept the request header
+#define OTP_EKEY       -8   // Key store refused the upload or pad range
+
+struct OtpPool;     // Opaque, see otp_lib.c
+struct OtpShm;      // Opaque, see otp_lib.c
+
+// Function Prototypes
+struct OtpPool* otpPoolOpen(char cliType, int port, const char* unixPath, int maxConxs);
+int otpPoolTransform(struct OtpPool* pool, const char* data, const char* key, char* outBuff, size_t len);
+void otpPoolClose(struct OtpPool* pool);
+int otpShmOpen(char cliType, const char* path, struct OtpShm** shm);
+int otpShmTransform(struct OtpShm* shm, const char* data, const char* key, char* outBuff, size_t len);
+void otpShmClose(struct OtpShm* shm);
+const char* otpStrError(int err);
+int otpConnect(int port, const char* unixPath);
+void otpMakeHeader(struct ReqHeader* header, char cliType, int op, unsigned long long len, int flags,
+                   unsigned long long keyId, unsigned long long keyOffset);
+int otpStatusError(char status);
+int otpRequest(int sockfd, char cliType, const char* data, const char* key, char* outBuff, size_t len);
+int otpSendAll(int sockfd, const char* dataToSend, size_t len);
+long long otpRecvAll(int sockfd, char* msgBuff, size_t len);
+
+#endif
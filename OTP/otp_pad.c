@@ -0,0 +1,89 @@
+/**********************************************************************************
+ Module Name: otp_pad
+ Description: Pad file mapping and consumption. See otp_pad.h.
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "otp_pad.h"
+
+
+/***********************************************************************
+ * Function Name: padInitHeader
+ * Description: This function fills in the header of a fresh pad.
+ **********************************************************************/
+void padInitHeader(struct PadHeader* header, unsigned long long keyId, unsigned long long padLen)
+{
+    memset(header, 0, sizeof(struct PadHeader));
+    memcpy(header->magic, PAD_MAGIC, sizeof(header->magic));
+    header->keyId = keyId;
+    header->padLen = padLen;
+    header->watermark = 0;
+}
+
+
+/***********************************************************************
+ * Function Name: padMap
+ * Description: This function maps a pad file read-write and shared, so
+    its watermark updates reach the file and every other process using
+    the pad. Returns the header (mapping length in mapLen), or NULL if
+    the file cannot be mapped or is not a well-formed pad.
+ **********************************************************************/
+struct PadHeader* padMap(const char* padPath, size_t* mapLen)
+{
+    struct PadHeader* header;
+    struct stat st;
+    int fd;
+
+    if((fd = open(padPath, O_RDWR)) == -1) {
+        return NULL;
+    }
+    if(fstat(fd, &st) == -1 || st.st_size < PAD_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(header == MAP_FAILED) {
+        return NULL;
+    }
+    if(memcmp(header->magic, PAD_MAGIC, sizeof(header->magic)) != 0 ||
+       header->padLen != (unsigned long long) st.st_size - PAD_HEADER_SIZE) {
+        munmap(header, st.st_size);
+        return NULL;
+    }
+    *mapLen = (size_t) st.st_size;
+    return header;
+}
+
+
+/***********************************************************************
+ * Function Name: padClaim
+ * Description: This function consumes pad chars [offset, offset + len).
+    With *offset == PAD_NEXT the range starts at the watermark, and the
+    offset used is stored back. The range must lie within the pad and
+    start at or after the watermark; any chars skipped before it are
+    consumed too. Returns the first claimed pad char, or NULL if the
+    range is unavailable.
+ **********************************************************************/
+const char* padClaim(struct PadHeader* header, unsigned long long* offset, unsigned long long len)
+{
+    unsigned long long watermark, start;
+
+    // Move the watermark past the range unless another claim got there first
+    watermark = __atomic_load_n(&header->watermark, __ATOMIC_ACQUIRE);
+    do {
+        start = (*offset == PAD_NEXT) ? watermark : *offset;
+        if(start < watermark || start > header->padLen || len > header->padLen - start) {
+            return NULL;
+        }
+    } while(!__atomic_compare_exchange_n(&header->watermark, &watermark, start + len, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    *offset = start;
+    return (const char*) header + PAD_HEADER_SIZE + start;
+}
@@ -0,0 +1,34 @@
+#ifndef otp_pad_h
+#define otp_pad_h
+/**********************************************************************************
+ Module Name: otp_pad
+ Description: Pad file format shared by keygen --pad, the clients' --pad option and
+     the daemons' key store. A pad file is a PadHeader, padded to PAD_HEADER_SIZE
+     bytes, followed by padLen raw key chars (no trailing newline). The header's
+     watermark is the first pad char not yet consumed. Pads are memory-mapped
+     MAP_SHARED and consumed with padClaim(), which moves the watermark past the
+     claimed range with an atomic compare-and-swap, so processes sharing a pad
+     never get overlapping ranges and a pad char is never handed out twice.
+ Reference Citation: http://man7.org/linux/man-pages/man2/mmap.2.html
+ *********************************************************************************/
+
+#include <stddef.h>
+
+#define PAD_MAGIC "OTPPAD1"     // First bytes of every pad file
+#define PAD_HEADER_SIZE 64      // Pad chars start here (keeps header on its own line)
+#define PAD_NEXT (~0ULL)        // Claim offset meaning "at the watermark"
+
+// Layout of the start of a pad file
+struct PadHeader {
+    char magic[8];                  // PAD_MAGIC
+    unsigned long long keyId;       // Key store ID (0 for pads made by keygen)
+    unsigned long long padLen;      // Pad chars following the header
+    unsigned long long watermark;   // First unconsumed pad char (updated atomically)
+};
+
+// Function Prototypes
+void padInitHeader(struct PadHeader* header, unsigned long long keyId, unsigned long long padLen);
+struct PadHeader* padMap(const char* padPath, size_t* mapLen);
+const char* padClaim(struct PadHeader* header, unsigned long long* offset, unsigned long long len);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef otp_proto_h
+#define otp_proto_h
+/**********************************************************************************
+ Module Name: otp_proto
+ Description: Wire protocol shared by the OTP clients and daemons.
+     1. Client sends one char identifying its type ('E' otp_enc, 'D' otp_dec).
+     2. Daemon replies 'Y' if it serves that type, otherwise 'N' and closes
+        (otp_d serves both, see otp_d.c).
+     3. Client sends the total message length as a 64-bit unsigned integer in
+        network byte order.
+     4. The message is streamed in chunks of CHUNK_SIZE chars (the last chunk may
+        be shorter). For each chunk the client sends the message chars followed
+        by the same number of key chars, and the daemon answers with the
+        transformed chunk. Neither side ever holds more than one chunk, so memory
+        use does not depend on the message length.
+     5. The conx stays open after a message: the daemon goes back to step 3 and
+        waits for the next length. A client may pipeline any number of messages
+        without waiting for replies; the daemon answers them in order. The client
+        ends the conx by closing (or shutting down) its side between messages.
+     6. The top 8 bits of the length word of step 3 select the request op (the
+        low 56 bits are the length). OP_MESSAGE (0) is the request of step 4.
+        The others use a daemon's key store (--keydir, see otp_keystore.h):
+          OP_KEY_UPLOAD: the client streams length pad chars in CHUNK_SIZE
+            chunks without waiting; the daemon answers with a status char ('Y'
+            or 'N') followed by the pad's 64-bit key ID in network byte order.
+          OP_KEYED_MESSAGE: the client sends the 64-bit key ID and 64-bit pad
+            offset (network byte order) and the daemon answers with a status
+            char. On 'Y' the message is streamed as in step 4 but with message
+            chunks only, the key being pad chars [offset, offset + length).
+        A daemon answering 'N' closes the conx, so a refused request also ends
+        any requests pipelined behind it.
+     7. Packed encoding: in step 1 a client may send its type char in lower case
+        ('e' or 'd') to ask for the packed wire encoding. A daemon that supports
+        it replies 'P' instead of 'Y', and from then on every run of chars on
+        the conx (message, key and pad chunks, transformed chunks) travels
+        packed: a chunk of n chars is sent as PACKED_LEN(n) bytes, each group of
+        8 symbols (space 0, 'A'-'Z' 1-26) forming a 40-bit little-endian value
+        with symbol j in bits 5j..5j+4 (the last group of a chunk may be short).
+        Lengths still count chars, and length words, key IDs, offsets and status
+        chars are unchanged. Older daemons answer 'N', after which the client
+        reconnects and asks again with the upper case char.
+     8. A daemon that is serving its conx limit with a full pending queue (see
+        otp_serv.h) replies 'B' (busy) in place of step 2's reply and closes at
+        once (REPLY_ERROR then 'B' on a header conx whose header has arrived by
+        then, see step 9; otherwise the plain 'B', which a header client tells
+        from a result by the close right behind it); the client may retry
+        later. A daemon also closes a conx whose current request or
+        chunk (counting the wait for it) outlives the daemon's deadline.
+     9. Header conxs: instead of steps 1-3, a client may open with a ReqHeader
+        (HDR_SIZE bytes, multi-byte fields in network byte order) and then send
+        one in place of every length word of step 3. Its first byte ('O') tells
+        it from a type char. The header carries the client type, op, flags
+        (HDR_PACKED for the packed encoding of step 7, per request), length and,
+        for OP_KEYED_MESSAGE, the key ID and pad offset, so a request needs no
+        permission or key status round trip: the client sends the header and
+        its first chunk in one write and reads the result straight away. The
+        daemon replies only on error: REPLY_ERROR (a byte no result or packed
+        chunk can start with) followed by a status char, and closes the conx:
+          STATUS_REFUSED: wrong client type for this daemon
+          STATUS_BUSY: as step 8
+          STATUS_VERSION: bad magic, unknown version, op or flags
+          STATUS_KEY: the key store refused the pad range (or the upload)
+        A successful OP_KEY_UPLOAD is still answered with 'Y' and the key ID.
+ *********************************************************************************/
+
+#define CHUNK_SIZE 65536    // Chars per streamed chunk
+
+#define OP_SHIFT 56                             // Op lives in the length word's top byte
+#define OP_LEN_MASK ((1ULL << OP_SHIFT) - 1)    // Length bits of the length word
+#define OP_MESSAGE 0            // Message and key chunks
+#define OP_KEY_UPLOAD 1         // Pad chunks for the key store
+#define OP_KEYED_MESSAGE 2      // Message chunks with a stored key
+
+#define PERM_PACKED 'P'         // Reply granting a packed conx (step 7)
+#define PERM_BUSY 'B'           // Reply of a daemon with no room for the conx (step 8)
+#define PACKED_LEN(chars) (((chars) * 5 + 7) / 8)  // Wire bytes of a packed run of chars
+
+#define HDR_MAGIC 0x4f545048U   // "OTPH", first field of a request header (step 9)
+#define HDR_VERSION 1
+#define HDR_PACKED 0x01         // Header flag: this request travels packed
+#define HDR_FLAGS_KNOWN HDR_PACKED
+#define HDR_SIZE 32
+
+#define REPLY_ERROR '\xff'      // Starts an error status (steps 8 and 9)
+#define STATUS_REFUSED 'N'
+#define STATUS_BUSY PERM_BUSY
+#define STATUS_VERSION 'V'
+#define STATUS_KEY 'K'
+
+// Request header of a header conx (step 9); HDR_SIZE bytes with no padding
+struct ReqHeader {
+    unsigned int magic;
+    unsigned char version;
+    unsigned char cliType;      // 'E' or 'D'
+    unsigned char op;           // OP_*
+    unsigned char flags;        // HDR_*
+    unsigned long long length;  // Message (or pad) chars
+    unsigned long long keyId;   // OP_KEYED_MESSAGE only, else 0
+    unsigned long long keyOffset;
+};
+
+#endif
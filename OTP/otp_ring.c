@@ -0,0 +1,85 @@
+/**********************************************************************************
+ Module Name: otp_ring
+ Description: Wait and wake-up primitives of the shared-memory ring. See
+     otp_ring.h. The futexes are shared between processes (the mapping is
+     MAP_SHARED), so the non-private futex ops are used.
+ Reference Citation: http://man7.org/linux/man-pages/man2/futex.2.html
+ *********************************************************************************/
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "otp_ring.h"
+
+
+/***********************************************************************
+ * Function Name: ringSpinLimit
+ * Description: This helper returns how long to spin before sleeping:
+    RING_SPIN polls on a multi-CPU host, none on a single CPU, where
+    spinning only delays the other side.
+ **********************************************************************/
+static int ringSpinLimit(void)
+{
+    static int spinLimit = -1;
+
+    if(spinLimit == -1) {
+        spinLimit = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? RING_SPIN : 0;
+    }
+    return spinLimit;
+}
+
+
+/***********************************************************************
+ * Function Name: ringWait
+ * Description: This function waits until counter moves past seen: it
+    spins briefly, then announces itself in waiting and sleeps on the
+    counter's futex. Gives up after timeoutMs (-1 = never), so the
+    caller can check on its peer. Returns the new counter value, or
+    seen on timeout.
+ **********************************************************************/
+int ringWait(unsigned int* counter, unsigned int seen, unsigned int* waiting, int timeoutMs)
+{
+    struct timespec timeout;
+    unsigned int value;
+    int spins, spinLimit = ringSpinLimit();
+
+    for(spins = 0; spins < spinLimit; spins++) {
+        if((value = __atomic_load_n(counter, __ATOMIC_ACQUIRE)) != seen) {
+            return value;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+    // Announce first, then re-check: the publisher stores, then reads waiting
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    while((value = __atomic_load_n(counter, __ATOMIC_SEQ_CST)) == seen)
+    {
+        if(syscall(SYS_futex, counter, FUTEX_WAIT, seen, (timeoutMs < 0) ? NULL : &timeout, NULL, 0) == -1 &&
+           errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+
+/***********************************************************************
+ * Function Name: ringPublish
+ * Description: This function stores a new counter value, making every
+    slot written before it visible, and wakes the peer if it sleeps.
+ **********************************************************************/
+void ringPublish(unsigned int* counter, unsigned int value, unsigned int* waiting)
+{
+    __atomic_store_n(counter, value, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, counter, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
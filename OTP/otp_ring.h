@@ -0,0 +1,59 @@
+#ifndef otp_ring_h
+#define otp_ring_h
+/**********************************************************************************
+ Module Name: otp_ring
+ Description: Shared-memory ring of the OTP daemons' --shm transport, used by
+     libotp (client side, see otp_lib.h) and otp_shm.c (daemon side). The
+     client creates a sealed memfd holding a RingHeader and numSlots RingSlots,
+     and hands it to the daemon over the --shm control socket (see otp_shm.c).
+     Each slot carries one chunk: the client writes len chars of message and
+     key, the daemon transforms the message in place, and the client reads the
+     result from the same slot, so a payload is copied once each way instead
+     of twice per direction through socket buffers. Slots are used in ring
+     order; two counters track them:
+       - submitted: slots filled by the client (written only by the client)
+       - completed: slots transformed by the daemon (written only by the daemon)
+     A side that finds nothing to do spins briefly (on multi-CPU hosts) and
+     then sleeps on the other side's counter with a futex, after setting its
+     waiting flag; the other side only makes the wake syscall when that flag
+     is set. The counters live on separate cache lines.
+ Reference Citation: http://man7.org/linux/man-pages/man2/futex.2.html
+ Reference Citation: http://man7.org/linux/man-pages/man2/memfd_create.2.html
+ *********************************************************************************/
+
+#include <stddef.h>
+#include "otp_proto.h"
+
+#define RING_MAGIC 0x5350544fU      // "OTPS"
+#define RING_SLOTS_DEFAULT 16       // Slots of a ring made by libotp
+#define RING_SLOTS_MAX 256
+#define RING_SLOT_CHARS CHUNK_SIZE  // Chars of message (and of key) per slot
+#define RING_SPIN 2000              // Polls before a side sleeps (multi-CPU hosts)
+#define RING_POLL_MS 1000           // How often a sleeping side checks that its peer is alive
+
+// Start of the shared mapping
+struct RingHeader {
+    unsigned int magic;
+    unsigned int numSlots;
+    unsigned int submitted __attribute__((aligned(64)));
+    unsigned int daemonWaiting;     // 1 while the daemon sleeps on submitted
+    unsigned int completed __attribute__((aligned(64)));
+    unsigned int clientWaiting;     // 1 while the client sleeps on completed
+    unsigned int closed;            // Set by the client when it detaches
+};
+
+// One chunk in flight
+struct RingSlot {
+    unsigned int len;
+    char data[RING_SLOT_CHARS] __attribute__((aligned(64)));    // Message, then result
+    char key[RING_SLOT_CHARS];
+};
+
+#define RING_SIZE(numSlots) (sizeof(struct RingHeader) + (size_t) (numSlots) * sizeof(struct RingSlot))
+#define RING_SLOT(header, idx) ((struct RingSlot*) ((char*) (header) + sizeof(struct RingHeader)) + (idx))
+
+// Function Prototypes
+int ringWait(unsigned int* counter, unsigned int seen, unsigned int* waiting, int timeoutMs);
+void ringPublish(unsigned int* counter, unsigned int value, unsigned int* waiting);
+
+#endif
@@ -0,0 +1,964 @@
+/**********************************************************************************
+ Module Name: otp_serv
+ Description: Server core shared by otp_enc_d, otp_dec_d and otp_d. See
+     otp_serv.h for an overview of the supported process models.
+ Reference Citation: http://beej.us/guide/bgnet/html/single/bgnet.html
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#define _GNU_SOURCE     // sched_setaffinity() and CPU_* macros
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "otp_serv.h"
+
+
+static volatile sig_atomic_t childrenReaped = 0;    // Fork-per-conx children reaped so far
+static volatile sig_atomic_t deadlineHit = 0;       // Blocking conx ran past its deadline
+
+
+/***********************************************************************
+ * Function Name: parseServArgs
+ * Description: This function reads the daemon's command line into the
+    given config struct. A listening port, --unix <path> or --shm <path>
+    is required; --workers N selects the pre-forked pool, --shards N the
+    SO_REUSEPORT shards, --backlog N the listen() backlog, --io= the I/O
+    engine, --keydir the key store, --stats the SIGUSR1 dump file,
+    --max-conns, --queue and --deadline the admission limits, and
+    --threads and --split-min the transform thread pool. Bad arguments
+    are a startup error.
+ **********************************************************************/
+void parseServArgs(int argc, const char* argv[], struct ServConfig* config)
+{
+    int i;
+
+    config->portNum = -1;
+    config->unixPath = NULL;
+    config->shmPath = NULL;
+    config->keyDir = NULL;
+    config->statsPath = NULL;
+    config->numWorkers = 0;
+    config->numShards = 0;
+    config->backlog = 5;
+    config->ioEngine = IO_BLOCKING;
+    config->maxConns = -1;      // Resolved by runServ() once the process model is known
+    config->queueLen = QUEUE_DEFAULT;
+    config->deadlineNs = DEADLINE_DEFAULT * 1000000000LL;
+    config->numThreads = 1;
+    config->splitMin = TPOOL_SPLIT_MIN_DEFAULT;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            config->numWorkers = atoi(argv[++i]);
+            if(config->numWorkers < 1 || config->numWorkers > WORKERS_MAX) {
+                fprintf(stderr, "Number of workers must be between 1 and %d.\n", WORKERS_MAX);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            config->numShards = atoi(argv[++i]);
+            if(config->numShards < 1 || config->numShards > SHARDS_MAX) {
+                fprintf(stderr, "Number of shards must be between 1 and %d.\n", SHARDS_MAX);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            config->backlog = atoi(argv[++i]);
+            if(config->backlog < 1) {
+                fprintf(stderr, "Backlog must be at least 1.\n");
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--max-conns") == 0 && i + 1 < argc) {
+            config->maxConns = atoi(argv[++i]);
+            if(config->maxConns < 0) {
+                fprintf(stderr, "Conx limit must be at least 0 (0 = no limit).\n");
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            config->queueLen = atoi(argv[++i]);
+            if(config->queueLen < 0 || config->queueLen > QUEUE_MAX) {
+                fprintf(stderr, "Queue length must be between 0 and %d.\n", QUEUE_MAX);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--deadline") == 0 && i + 1 < argc) {
+            config->deadlineNs = (long long) (atof(argv[++i]) * 1e9);
+            if(config->deadlineNs < 0) {
+                fprintf(stderr, "Deadline must be at least 0 seconds (0 = none).\n");
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            config->numThreads = atoi(argv[++i]);
+            if(config->numThreads < 1 || config->numThreads > TPOOL_THREADS_MAX) {
+                fprintf(stderr, "Number of threads must be between 1 and %d.\n", TPOOL_THREADS_MAX);
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--split-min") == 0 && i + 1 < argc) {
+            config->splitMin = atoll(argv[++i]);
+            if(config->splitMin < 0) {
+                fprintf(stderr, "Split threshold must be at least 0.\n");
+                exit(1);
+            }
+        }
+        else if(strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            config->unixPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            config->shmPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--keydir") == 0 && i + 1 < argc) {
+            config->keyDir = argv[++i];
+        }
+        else if(strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            config->statsPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--io=blocking") == 0) {
+            config->ioEngine = IO_BLOCKING;
+        }
+        else if(strcmp(argv[i], "--io=epoll") == 0) {
+            config->ioEngine = IO_EPOLL;
+        }
+        else if(strcmp(argv[i], "--io=uring") == 0) {
+            config->ioEngine = IO_URING;
+        }
+        else if(config->portNum == -1 && argv[i][0] != '-') {
+            config->portNum = atoi(argv[i]);
+        }
+        else {
+            fprintf(stderr, "Unrecognized argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    // Ensure a port number (or socket path) was received
+    if(config->portNum == -1 && config->unixPath == NULL && config->shmPath == NULL)
+    {
+        fprintf(stderr, "Please include a port number, --unix <path> or --shm <path> argument.\n");
+        exit(1);
+    }
+
+    // Shards are separate TCP listeners, each served by one process
+    if(config->numShards > 0 && (config->numWorkers > 0 || config->unixPath != NULL))
+    {
+        fprintf(stderr, "--shards cannot be combined with --workers or --unix.\n");
+        exit(1);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: runShmServ
+ * Description: This helper opens the --shm control socket and serves
+    it: in this process when the daemon has no other listener (never
+    returning), else in a forked listener process.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/prctl.2.html
+ **********************************************************************/
+static void runShmServ(struct ServConfig* config, struct ServMode* mode)
+{
+    struct ServConfig shmConfig = *config;
+    int shmSock;
+    pid_t spawnPid;
+
+    shmConfig.unixPath = config->shmPath;
+    shmSock = createServSock(&shmConfig);
+    if(config->portNum == -1 && config->unixPath == NULL) {
+        runShmListener(shmSock, config, mode);
+    }
+
+    spawnPid = fork();
+    if(spawnPid == -1) {
+        fprintf(stderr, "Error from fork() call.\n");
+        exit(1);
+    }
+    if(spawnPid == 0) {     // SHM LISTENER: die with the daemon instead of lingering
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        runShmListener(shmSock, config, mode);
+        exit(1);
+    }
+    close(shmSock);
+}
+
+
+/***********************************************************************
+ * Function Name: runServ
+ * Description: This function implements a server to handle requests
+    from the client type given by mode. It sets up the listening socket
+    and hands it to the configured process model. The epoll and
+    io_uring engines without --workers run in this single process.
+    The --shm control socket gets a listener process of its own, which
+    dies with the daemon; with --shm alone it is the daemon.
+ **********************************************************************/
+void runServ(struct ServConfig* config, struct ServMode* mode)
+{
+    int servSock;
+
+    // Stats table and key store must exist before any process is forked
+    statsInit(mode->progName, config->statsPath);
+    if(config->keyDir != NULL && keyStoreOpen(config->keyDir) == -1) {
+        fprintf(stderr, "%s: cannot use key directory %s\n", mode->progName, config->keyDir);
+        exit(1);
+    }
+
+    // Pick the codec kernels now, before helper or shm session threads could race on it
+    selectCodec(NULL);
+
+    // Helpers start on first use, in whichever process serves the message
+    tpoolConfig(config->numThreads, config->splitMin);
+
+    // Shm sessions are only bounded by an explicit --max-conns (else SHM_SESSIONS_MAX)
+    if(config->shmPath != NULL) {
+        runShmServ(config, mode);
+        if(config->portNum == -1 && config->unixPath == NULL) {
+            return;
+        }
+    }
+
+    // Only the fork-per-conx daemon is limited by default
+    if(config->maxConns == -1) {
+        config->maxConns = (config->numWorkers == 0 && config->numShards == 0 &&
+                            config->ioEngine == IO_BLOCKING) ? MAX_CONNS_DEFAULT : 0;
+    }
+
+    if(config->numShards > 0) {     // Every shard opens its own listener
+        runShards(config, mode);
+        return;
+    }
+
+    // Setup server socket
+    servSock = createServSock(config);
+
+    if(config->numWorkers > 0) {
+        runWorkerPool(servSock, config, mode);
+    }
+    else if(config->ioEngine == IO_EPOLL) {
+        runEpollEngine(servSock, config, mode);
+    }
+    else if(config->ioEngine == IO_URING) {
+        runUringEngine(servSock, config, mode);
+    }
+    else {
+        runForkPerConx(servSock, config, mode);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: servTransform
+ * Description: This function returns the kernel serving clients of
+    type cliType ('E' or 'D'), or NULL if the daemon does not accept
+    them. otp_d accepts both, so every conx (and, with request headers,
+    every request) is dispatched to the kernel its client type names.
+ **********************************************************************/
+TransformFx servTransform(struct ServMode* mode, char cliType)
+{
+    if(mode->cliType != CLI_ANY) {
+        return (cliType == mode->cliType) ? mode->transform : NULL;
+    }
+    if(cliType == 'E') {
+        return encryptData;
+    }
+    return (cliType == 'D') ? decryptData : NULL;
+}
+
+
+/***********************************************************************
+ * Function Name: forkClient
+ * Description: This helper spawns a child to handle one client's
+    request. The parent only listens and counts the child as active.
+ **********************************************************************/
+static void forkClient(int servSock, int newClient, sigset_t* childMask,
+                       struct ServConfig* config, struct ServMode* mode)
+{
+    pid_t spawnPid = fork();    // Spawn process to handle client request
+
+    switch(spawnPid)
+    {
+        case -1:            // ERROR CASE
+            fprintf(stderr, "Error from fork() call.\n");
+            exit(1);
+            break;
+        case 0:             // CHILD
+            sigprocmask(SIG_SETMASK, childMask, NULL);
+            close(servSock);
+            serveClient(newClient, config, mode);
+            exit(0);
+            break;
+        default:        //PARENT (Let's child do the work, parent listens for next conx)
+
+            break;
+    }
+    close(newClient);   // Close connection
+}
+
+
+/***********************************************************************
+ * Function Name: runForkPerConx
+ * Description: This function accepts conxs forever, spawning a new
+    child to handle each client's request, as long as fewer than
+    maxConns children are running. Further conxs wait in the pending
+    queue and are handed to a child as others exit; once the queue is
+    full they are turned away with a busy reply. SIGCHLD stays blocked
+    except while the parent waits in ppoll(), so a child exit always
+    wakes the parent to start the next queued conx.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/ppoll.2.html
+ **********************************************************************/
+void runForkPerConx(int servSock, struct ServConfig* config, struct ServMode* mode)
+{
+    int newClient, numReady, numActive = 0, numReaped = 0;
+    long long waitNs;
+    struct timespec waitTime;
+    struct sockaddr_in cliAddress;
+    socklen_t cliAddressSize = sizeof(cliAddress);
+    struct PendingQueue pending;
+    struct pollfd listenReady;
+    sigset_t chldMask, waitMask;
+
+    // Setup SIGCHLD handler to handle zombies
+    struct sigaction SIGCHLD_action;    // Declare sigaction struct for SIGCHLD
+    memset(&SIGCHLD_action, 0, sizeof(SIGCHLD_action));
+    SIGCHLD_action.sa_handler = handleSIGCHLD;  // Assign fx to be called when SIGCHLD received
+    SIGCHLD_action.sa_flags = SA_RESTART;       // To handle interrupted system calls
+    sigaction(SIGCHLD, &SIGCHLD_action, NULL);   // Register signal handler
+
+    sigemptyset(&chldMask);
+    sigaddset(&chldMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chldMask, &waitMask);   // waitMask: mask to restore in children
+    pendingInit(&pending, config->queueLen);
+
+    // Loop forever
+    while(1)
+    {
+        // Hand queued conxs to the slots freed by exited children
+        numActive -= childrenReaped - numReaped;
+        numReaped = childrenReaped;
+        while((config->maxConns == 0 || numActive < config->maxConns) &&
+              (newClient = pendingPop(&pending, config->deadlineNs)) != -1) {
+            forkClient(servSock, newClient, &waitMask, config, mode);
+            numActive++;
+        }
+
+        // Sleep until a conx arrives, a child exits or a queued conx expires
+        listenReady.fd = servSock;
+        listenReady.events = POLLIN;
+        waitNs = pendingExpire(&pending, config->deadlineNs);
+        waitTime.tv_sec = waitNs / 1000000000LL;
+        waitTime.tv_nsec = waitNs % 1000000000LL;
+        numReady = ppoll(&listenReady, 1, (waitNs == -1) ? NULL : &waitTime, &waitMask);
+        if(numReady == 0) {
+            continue;
+        }
+        if(numReady == -1) {
+            if(errno == EINTR) {
+                statsPoll();
+            }
+            continue;
+        }
+
+        // Accept next client
+        cliAddressSize = sizeof(cliAddress);
+        newClient = accept(servSock, (struct sockaddr*) &cliAddress, &cliAddressSize);
+        if(newClient < 0) {
+            if(errno != EINTR) {
+                fprintf(stderr, "%s: error from accept() call.\n", mode->progName);
+            }
+            continue;
+        }
+
+        if(config->maxConns == 0 || numActive < config->maxConns) {
+            forkClient(servSock, newClient, &waitMask, config, mode);
+            numActive++;
+        }
+        else if(pendingPush(&pending, newClient) == -1) {
+            rejectBusy(newClient);
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: runWorkerPool
+ * Description: This function forks numWorkers long-lived workers that
+    all accept() on the shared listening socket. The parent only
+    supervises: whenever a worker exits it is reaped and replaced (in
+    the same stats slot), so the pool stays at full size.
+ **********************************************************************/
+void runWorkerPool(int servSock, struct ServConfig* config, struct ServMode* mode)
+{
+    pid_t workerPids[WORKERS_MAX];
+    pid_t deadPid;
+    int i;
+
+    // Workers are reaped by wait() below rather than by a SIGCHLD handler
+    signal(SIGCHLD, SIG_DFL);
+
+    for(i = 0; i < config->numWorkers; i++) {
+        workerPids[i] = spawnWorker(servSock, i, config, mode);
+    }
+
+    // Supervise forever
+    while(1)
+    {
+        deadPid = wait(NULL);
+        if(deadPid == -1) {
+            if(errno == EINTR) {
+                statsPoll();
+            }
+            else {
+                fprintf(stderr, "%s: error from wait() call.\n", mode->progName);
+                sleep(1);
+            }
+            continue;
+        }
+        for(i = 0; i < config->numWorkers; i++) {
+            if(workerPids[i] == deadPid) {
+                fprintf(stderr, "%s: worker %d exited, respawning.\n", mode->progName, (int) deadPid);
+                workerPids[i] = spawnWorker(servSock, i, config, mode);
+            }
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: runShards
+ * Description: This function opens numShards SO_REUSEPORT listeners on
+    the same port and forks one shard process per listener, pinned to
+    its own core. The kernel hashes each new conx to one listener, so
+    shards never contend on a shared accept queue. The parent keeps
+    every listener open and respawns a shard that exits on the same
+    listener, so conxs already queued there are not lost.
+ * Reference Citation: http://man7.org/linux/man-pages/man7/socket.7.html
+ **********************************************************************/
+void runShards(struct ServConfig* config, struct ServMode* mode)
+{
+    int shardSocks[SHARDS_MAX];
+    pid_t shardPids[SHARDS_MAX];
+    pid_t deadPid;
+    int i;
+
+    // Shards are reaped by wait() below rather than by a SIGCHLD handler
+    signal(SIGCHLD, SIG_DFL);
+
+    for(i = 0; i < config->numShards; i++) {
+        shardSocks[i] = createServSock(config);
+    }
+    for(i = 0; i < config->numShards; i++) {
+        shardPids[i] = spawnWorker(shardSocks[i], i, config, mode);
+    }
+
+    // Supervise forever
+    while(1)
+    {
+        deadPid = wait(NULL);
+        if(deadPid == -1) {
+            if(errno == EINTR) {
+                statsPoll();
+            }
+            else {
+                fprintf(stderr, "%s: error from wait() call.\n", mode->progName);
+                sleep(1);
+            }
+            continue;
+        }
+        for(i = 0; i < config->numShards; i++) {
+            if(shardPids[i] == deadPid) {
+                fprintf(stderr, "%s: shard %d exited, respawning.\n", mode->progName, i);
+                shardPids[i] = spawnWorker(shardSocks[i], i, config, mode);
+            }
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: pinToCore
+ * Description: This function pins the calling process to the shardIdx-th
+    CPU it is allowed to run on (wrapping around when there are more
+    shards than CPUs).
+ * Reference Citation: http://man7.org/linux/man-pages/man2/sched_setaffinity.2.html
+ **********************************************************************/
+static void pinToCore(int shardIdx)
+{
+    cpu_set_t allowed, pinned;
+    int cpu, numAllowed, target;
+
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || (numAllowed = CPU_COUNT(&allowed)) == 0) {
+        return;
+    }
+    target = shardIdx % numAllowed;
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if(CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            CPU_ZERO(&pinned);
+            CPU_SET(cpu, &pinned);
+            sched_setaffinity(0, sizeof(pinned), &pinned);
+            return;
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: spawnWorker
+ * Description: This function forks pool worker (or shard) workerIdx.
+    A blocking worker loops on accept() and serves each client in turn;
+    an epoll or io_uring worker runs its own event loop on the socket.
+    Shards are pinned to a core. Every worker updates its own stats
+    slot. It never returns to the caller in the child. Returns the
+    worker's pid in the parent.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/prctl.2.html
+ **********************************************************************/
+pid_t spawnWorker(int servSock, int workerIdx, struct ServConfig* config, struct ServMode* mode)
+{
+    int newClient;
+    pid_t spawnPid = fork();
+
+    if(spawnPid == -1) {
+        fprintf(stderr, "Error from fork() call.\n");
+        exit(1);
+    }
+    if(spawnPid > 0) {  // PARENT
+        return spawnPid;
+    }
+
+    // WORKER: die with the supervising daemon instead of lingering
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    statsUseSlot(workerIdx + 1);        // Slot 0 is the main process's
+    if(config->numShards > 0) {
+        pinToCore(workerIdx);
+    }
+
+    if(config->ioEngine == IO_EPOLL) {
+        runEpollEngine(servSock, config, mode);
+        exit(1);
+    }
+    if(config->ioEngine == IO_URING) {
+        runUringEngine(servSock, config, mode);
+        exit(1);
+    }
+
+    while(1)
+    {
+        newClient = accept(servSock, NULL, NULL);
+        if(newClient < 0) {
+            if(errno != EINTR) {
+                fprintf(stderr, "%s: error from accept() call.\n", mode->progName);
+            }
+            continue;
+        }
+        serveClient(newClient, config, mode);
+        close(newClient);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: handleSIGALRM
+ * Description: This handler flags that the blocking conx ran past its
+    deadline. It is installed without SA_RESTART, so the blocked recv()
+    or send() fails with EINTR and the conx is dropped.
+ **********************************************************************/
+static void handleSIGALRM(int signal)
+{
+    (void) signal;
+    deadlineHit = 1;
+}
+
+
+/***********************************************************************
+ * Function Name: armDeadline
+ * Description: This helper starts (or with 0, stops) the deadline timer
+    of a blocking conx. Once expired it keeps firing every 100 ms, so a
+    call that blocks again after a partial transfer is interrupted too.
+    Returns 0, or -1 if the timer could not be set.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/setitimer.2.html
+ **********************************************************************/
+static int armDeadline(long long deadlineNs)
+{
+    struct itimerval timer;
+
+    memset(&timer, 0, sizeof(timer));
+    if(deadlineNs > 0) {
+        timer.it_value.tv_sec = deadlineNs / 1000000000LL;
+        timer.it_value.tv_usec = (deadlineNs % 1000000000LL) / 1000 + 1;
+        if(timer.it_value.tv_usec >= 1000000) {     // Rounded up to a whole second
+            timer.it_value.tv_sec++;
+            timer.it_value.tv_usec -= 1000000;
+        }
+        timer.it_interval.tv_usec = 100000;
+    }
+    if(setitimer(ITIMER_REAL, &timer, NULL) == -1) {
+        fprintf(stderr, "Error from setitimer() call.\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: serveClient
+ * Description: This function handles one client conx on the given
+    socket with blocking I/O. It drives the conx state machine, doing
+    each requested read or write in full before advancing it. The
+    deadline timer is restarted whenever the conx starts waiting for a
+    new request; if it fires, the conx is dropped.
+ **********************************************************************/
+void serveClient(int sockfd, struct ServConfig* config, struct ServMode* mode)
+{
+    struct Conx conx;
+    struct sigaction SIGALRM_action;
+    long long armedAt;
+
+    if(config->deadlineNs > 0) {
+        memset(&SIGALRM_action, 0, sizeof(SIGALRM_action));
+        SIGALRM_action.sa_handler = handleSIGALRM;
+        SIGALRM_action.sa_flags = 0;
+        sigaction(SIGALRM, &SIGALRM_action, NULL);
+    }
+
+    conxInit(&conx, sockfd);
+    deadlineHit = 0;
+    armedAt = conx.requestStart - 1;
+    do
+    {
+        if(conx.requestStart != armedAt) {      // Next request, fresh deadline
+            if(armDeadline(config->deadlineNs) == -1) {
+                break;  // Never serve a conx without its deadline
+            }
+            armedAt = conx.requestStart;
+        }
+        if(conx.isWrite) {
+            if(sendData(sockfd, conx.ioBuff, conx.ioLen) == -1) {
+                break;  // Client hung up mid-request
+            }
+        }
+        else if(recvAll(sockfd, conx.ioBuff, conx.ioLen) < conx.ioLen) {
+            break;      // Client hung up or errored mid-request
+        }
+        conx.ioDone = conx.ioLen;
+    } while(conxAdvance(&conx, mode) == 0);
+
+    armDeadline(0);
+    if(deadlineHit) {
+        statsCount(STAT_EXPIRED, 1);
+        deadlineHit = 0;
+    }
+    conxFree(&conx);
+}
+
+
+/***********************************************************************
+ * Function Name: createServSock
+ * Description: This function is used to setup a server socket on the
+    port given by the command line argument, or on a unix domain socket
+    at config->unixPath. Same-host clients using the latter skip the
+    TCP/IP stack entirely.
+ * Reference Citation: http://beej.us/guide/bgnet/html/single/bgnet.html
+    and proivided class code and notes.
+ **********************************************************************/
+int createServSock(struct ServConfig* config)
+{
+    int servSock;
+    struct sockaddr_in servAddress;
+    struct sockaddr_un unixAddress;
+    int optval = 1;
+    socklen_t optlen = sizeof(optval);
+
+    if(config->unixPath != NULL)
+    {
+        // Fill unix Socket Address Struct
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        if(strlen(config->unixPath) >= sizeof(unixAddress.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", config->unixPath);
+            exit(1);
+        }
+        strcpy(unixAddress.sun_path, config->unixPath);
+
+        // Create a new socket (passive) (local and connection-oriented)
+        if((servSock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            fprintf(stderr, "Error from socket() system call.\n");
+            exit(1);
+        }
+
+        // Remove a socket file left behind by an earlier run
+        unlink(config->unixPath);
+
+        if(bind(servSock, (struct sockaddr*) &unixAddress, sizeof(unixAddress)) == -1) {
+            fprintf(stderr, "Error from bind() system call.\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        // Fill Socket Address Struct
+        memset(&servAddress, 0, sizeof(servAddress));
+        servAddress.sin_family = AF_INET;               // Address family for IPv4
+        servAddress.sin_port = htons(config->portNum);  // host to network conversion
+        servAddress.sin_addr.s_addr = INADDR_ANY;       // Any address allowed to connect
+
+        // Create a new socket (passive) (IPv4 and connection-oriented)
+        if((servSock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+            fprintf(stderr, "Error from socket() system call.\n");
+            exit(1);
+        }
+
+        // Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203 pages 1278 - 1280
+        // Set SO_REUSEADDR Socket Option to avoid "Address already in use" error
+        setsockopt(servSock, SOL_SOCKET, SO_REUSEADDR, &optval, optlen);
+
+        // Disable Nagle so each reply chunk leaves at once instead of waiting on the
+        // client's delayed ACK (accepted sockets inherit this on Linux)
+        setsockopt(servSock, IPPROTO_TCP, TCP_NODELAY, &optval, optlen);
+
+        // Let every shard bind its own listener to the port
+        if(config->numShards > 0) {
+            setsockopt(servSock, SOL_SOCKET, SO_REUSEPORT, &optval, optlen);
+        }
+
+        // Bind socket to address
+        if(bind(servSock, (struct sockaddr*) &servAddress, sizeof(servAddress)) == -1) {
+            fprintf(stderr, "Error from bind() system call.\n");
+            exit(1);
+        }
+    }
+
+    // Allow control socket to accept incoming conxs (conx P) (backlog of 5 unless --backlog)
+    if((listen(servSock, config->backlog)) == -1) {
+        fprintf(stderr, "Error from listen() system call.\n");
+        exit(1);
+    }
+    statsAddListener(servSock);     // Accept queue depth is part of the stats dump
+
+    return servSock;    // Return socket file descriptor
+}
+
+
+/****************************************************************************
+ *Function Name: sendData
+ *Description: This function is used to send data to peer via the given
+    file descriptor argument. It loops until every byte has been handed to
+    the kernel, retrying partial sends and waiting in poll() whenever the
+    socket buffer is full. Delivery is confirmed by the protocol itself (the
+    client's next frame or hang-up), so there is no need to spin on the send
+    queue. Returns 0 on success, -1 if the conx failed or ran past its
+    deadline.
+ *Reference Citation: http://beej.us/guide/bgnet/html/multi/advanced.html#sendall
+ *Reference Citation: http://man7.org/linux/man-pages/man2/poll.2.html
+ ****************************************************************************/
+int sendData(int sockfd, char* dataToSend, int len)
+{
+    int bytesLeft = len;        // Bytes not yet handed to the kernel
+    ssize_t bytesSent;          // Bytes taken by last send() call
+    struct pollfd sendReady;
+
+    while(bytesLeft > 0 && !deadlineHit)
+    {
+        bytesSent = send(sockfd, dataToSend, bytesLeft, MSG_NOSIGNAL);
+        if(bytesSent > 0) {
+            dataToSend += bytesSent;    // Skip past what was sent
+            bytesLeft -= bytesSent;
+        }
+        else if(bytesSent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            sendReady.fd = sockfd;      // Sleep until there is buffer space
+            sendReady.events = POLLOUT;
+            poll(&sendReady, 1, -1);
+        }
+        else if(bytesSent == -1 && errno == EINTR) {
+            continue;
+        }
+        else {
+            fprintf(stderr, "Error sending to client.\n");
+            return -1;
+        }
+    }
+    return deadlineHit ? -1 : 0;
+}
+
+
+/***********************************************************************
+ * Function Name: recvAll
+ * Description: This function is used to ensure that all expected
+    bytes are received. The function loops to until the required number
+    recv() calls receives the cumulative total of expected bytes.
+    Returns the number of bytes received (less than len on EOF/error).
+ * Reference Citation: http://man7.org/linux/man-pages/man2/recv.2.html
+ **********************************************************************/
+int recvAll(int sockfd, char* msgBuff, int len)
+{
+    int bytesToRecv = len;      // Expected  bytes to be received
+    int bytesRcvd;              // Bytes read by last recv() call
+
+    // Loop until all bytes are received or an error occurs
+    while(bytesToRecv > 0 && (bytesRcvd = recv(sockfd, msgBuff, bytesToRecv, 0)) > 0) {
+        msgBuff += bytesRcvd;       // Add bytes to cumulative buffer
+        bytesToRecv -= bytesRcvd;   // Adjust the # of bytes still expected
+    }
+    return len - bytesToRecv;
+}
+
+
+/***********************************************************************
+ * Function Name: handleSIGCHLD
+ * Description: This signal handler is used to reap zombies.
+ * Reference Citation: https://linux.die.net/man/2/waitpid
+ **********************************************************************/
+void handleSIGCHLD(int signal)
+{
+    int savedErrno = errno;
+
+    (void) signal;
+    // using -1 as first parameter to indicate wait for any child process
+    // the loop reaps zombies and counts them, freeing their conx slots
+    while( waitpid(-1, 0, WNOHANG) > 0) {
+        childrenReaped++;
+    }
+    errno = savedErrno;
+}
+
+
+/***********************************************************************
+ * Function Name: pendingInit
+ * Description: This function sets up an empty pending queue holding
+    at most cap conxs.
+ **********************************************************************/
+void pendingInit(struct PendingQueue* queue, int cap)
+{
+    queue->fds = malloc((cap + 1) * sizeof(int));
+    queue->since = malloc((cap + 1) * sizeof(long long));
+    queue->cap = cap;
+    queue->head = 0;
+    queue->count = 0;
+    if(queue->fds == NULL || queue->since == NULL) {
+        fprintf(stderr, "Out of memory for the pending queue.\n");
+        exit(1);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: pendingPush
+ * Description: This function appends an accepted conx to the queue.
+    Returns 0, or -1 if the queue is full.
+ **********************************************************************/
+int pendingPush(struct PendingQueue* queue, int sockfd)
+{
+    int tail;
+
+    if(queue->count == queue->cap) {
+        return -1;
+    }
+    tail = (queue->head + queue->count++) % queue->cap;
+    queue->fds[tail] = sockfd;
+    queue->since[tail] = statsNow();
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: pendingExpire
+ * Description: This function turns away the queued conxs that waited
+    longer than deadlineNs (when set). Returns the ns until the oldest
+    remaining one expires, or -1 if none will.
+ **********************************************************************/
+long long pendingExpire(struct PendingQueue* queue, long long deadlineNs)
+{
+    long long waited;
+
+    if(deadlineNs == 0) {
+        return -1;
+    }
+    while(queue->count > 0)
+    {
+        waited = statsNow() - queue->since[queue->head];
+        if(waited < deadlineNs) {
+            return deadlineNs - waited;
+        }
+        rejectBusy(queue->fds[queue->head]);
+        queue->head = (queue->head + 1) % queue->cap;
+        queue->count--;
+    }
+    return -1;
+}
+
+
+/***********************************************************************
+ * Function Name: pendingPop
+ * Description: This function removes the oldest conx from the queue and
+    returns its socket, or -1 if the queue is empty. Conxs that waited
+    past the deadline are turned away on the way.
+ **********************************************************************/
+int pendingPop(struct PendingQueue* queue, long long deadlineNs)
+{
+    int sockfd;
+
+    pendingExpire(queue, deadlineNs);
+    if(queue->count == 0) {
+        return -1;
+    }
+    sockfd = queue->fds[queue->head];
+    queue->head = (queue->head + 1) % queue->cap;
+    queue->count--;
+    return sockfd;
+}
+
+
+/***********************************************************************
+ * Function Name: rejectBusy
+ * Description: This function turns a conx away: it sends the busy
+    status in place of the permission reply (without blocking), lingers
+    and closes the socket. Handshake clients get the plain 'B' they have
+    always got; a conx whose request header has already arrived gets
+    REPLY_ERROR 'B', which it can tell from a result. The first byte
+    tells them apart, so it is peeked at, but never waited for: the
+    engines call this from their event loops, so a conx that has sent
+    nothing yet gets the plain 'B', which fails a header client's
+    request as well.
+ **********************************************************************/
+void rejectBusy(int sockfd)
+{
+    char busy[2] = { REPLY_ERROR, STATUS_BUSY };
+    char first = 0;
+    int headerConx;
+
+    recv(sockfd, &first, sizeof(first), MSG_PEEK | MSG_DONTWAIT);
+    headerConx = (first == (char) (HDR_MAGIC >> 24));
+    send(sockfd, headerConx ? busy : busy + 1, headerConx ? sizeof(busy) : 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    lingerSock(sockfd);
+    close(sockfd);
+    statsCount(STAT_BUSY, 1);
+}
+
+
+/***********************************************************************
+ * Function Name: lingerSock
+ * Description: This function readies a socket whose last reply was a
+    refusal for closing: it shuts down the sending side and drains
+    whatever the client already sent (without blocking), so the close
+    is not a reset that could discard the reply.
+ **********************************************************************/
+void lingerSock(int sockfd)
+{
+    char discard[4096];
+
+    shutdown(sockfd, SHUT_WR);
+    while(recv(sockfd, discard, sizeof(discard), MSG_DONTWAIT) > 0);
+}
@@ -0,0 +1,211 @@
+#ifndef otp_serv_h
+#define otp_serv_h
+/**********************************************************************************
+ Module Name: otp_serv
+ Description: Server core shared by otp_enc_d, otp_dec_d and otp_d. The daemons only
+     differ in the client types they accept ('E', 'D', or both for otp_d) and in the
+     transform they apply to the received data, so each is described by a ServMode
+     and handed to runServ(); servTransform() picks the kernel for a client type.
+     otp_d serves both from one set of processes, conx limits and buffers. Blocking
+     workers are each held by one keep-alive conx, so its --workers count covers the
+     conxs of both client types. The server runs in one of three process models:
+       - fork per connection (default): the listening process fork()s a child for
+         every accepted conx, as the daemons always have.
+       - pre-forked pool (--workers N): N long-lived worker processes are forked at
+         startup. Every worker blocks in accept() on the shared listening socket and
+         serves many requests, so no fork() is paid per request.
+       - shards (--shards N): N listeners bound to the same port with
+         SO_REUSEPORT, each served by its own worker process pinned to a core.
+         The kernel spreads new conxs across the listeners, so there is no
+         single accept queue for the workers to contend on.
+     Independently of the process model, each process drives its conxs with one of
+     three I/O engines (--io=blocking|epoll|uring):
+       - blocking (default): one conx at a time, blocking recv()/send().
+       - epoll (--io=epoll): a single non-blocking epoll loop multiplexes
+         thousands of conxs in one process. Combined with --workers N, every
+         worker runs its own epoll loop on the shared listening socket.
+       - io_uring (--io=uring): like epoll, but accepts, reads and writes are
+         batched on a submission ring with registered buffers, so one syscall
+         submits and reaps many operations (see otp_uring.c).
+     All three engines drive the same per-conx protocol state machine (otp_conx.c).
+     With --unix <path> the daemon listens on a unix domain socket instead of a TCP
+     port, for clients on the same host. With --keydir <dir> the daemon keeps a key
+     store there, so clients can upload a pad once and then send only message chunks
+     (see otp_keystore.h). Counters and per-phase latency histograms are kept for
+     every process and dumped on SIGUSR1 (see otp_stats.h). Clients may negotiate
+     the 5-bit packed wire encoding at the handshake (see otp_proto.h). Clients that
+     open with a request header instead of the handshake char send each request's
+     type, op, length and flags in one 32-byte header ahead of its first chunk,
+     skipping the handshake round trip; the daemon answers such conxs early only to
+     refuse a request, with REPLY_ERROR and a status char, and then closes them.
+     With --threads N, each daemon process splits the transform of every chunk of a
+     message of at least --split-min chars among N threads (see otp_tpool.h). With
+     --shm <path>, co-located clients can also attach a shared-memory ring on a
+     control socket at path and have chunks transformed in place in it, with no
+     socket copies (see otp_ring.h and otp_shm.c); --shm alone serves only such
+     clients.
+     Admission control bounds the work a daemon takes on. The fork-per-conx
+     daemon, and each epoll or io_uring process, serves at most --max-conns conxs
+     at once (5 by default for fork per conx, otherwise unlimited, io_uring
+     being capped at URING_CONX_MAX anyway). Conxs accepted beyond that wait in
+     a FIFO of --queue entries and start as soon as a conx closes; once the FIFO
+     is full, new conxs are turned away at once with a busy reply instead
+     of forking or queueing without bound. Blocking pool workers and shards are
+     already bounded by their number and leave queueing to the listen backlog.
+     Every conx also has a --deadline: a request, or one chunk of a streamed
+     message (together with the wait for it, so an idle conx counts too), that
+     is not done in time gets its conx closed, so slow or stalled clients
+     cannot hold a worker or slot forever.
+     A conx that waited in the FIFO past the deadline is turned away as busy.
+     Syntax: <daemon> <listening_port>|--unix <path> [--shm <path>] [--workers N | --shards N]
+             [--backlog N] [--io=blocking|epoll|uring] [--keydir <dir>]
+             [--stats <path>] [--max-conns N] [--queue N] [--deadline <seconds>]
+             [--threads N] [--split-min <chars>]
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <sys/types.h>
+#include "otp_proto.h"
+#include "otp_codec.h"
+#include "otp_keystore.h"
+#include "otp_stats.h"
+#include "otp_tpool.h"
+#include "otp_slab.h"
+#include "otp_ring.h"
+
+#define WORKERS_MAX 256     // Upper bound for --workers
+#define SHARDS_MAX 256      // Upper bound for --shards
+#define EPOLL_EVENTS_MAX 256    // Events fetched per epoll_wait() call
+#define ACCEPT_RETRY_MS 100     // Retry accept() this long after running out of fds
+#define URING_CONX_MAX 128      // Conxs served at once by one io_uring process
+#define URING_ENTRIES 256       // Submission queue size of the io_uring engine
+#define MAX_CONNS_DEFAULT 5     // Conxs served at once by the fork-per-conx daemon
+#define QUEUE_DEFAULT 64        // Accepted conxs that may wait for a free slot
+#define QUEUE_MAX 65536         // Upper bound for --queue
+#define DEADLINE_DEFAULT 30     // Seconds a request (or the wait for one) may take
+#define SHM_SESSIONS_MAX 64     // Shm sessions served at once without --max-conns
+#define CLI_ANY '*'             // ServMode client type of otp_d, which accepts both
+
+// Describes the daemon being run (otp_enc_d, otp_dec_d or otp_d)
+struct ServMode {
+    const char* progName;   // Used in error messages
+    char cliType;           // Client type accepted ('E' or 'D'), or CLI_ANY
+    TransformFx transform;  // Applied to each message (NULL with CLI_ANY, see servTransform())
+};
+
+// I/O engine used to drive conxs within one process
+enum IoEngine { IO_BLOCKING, IO_EPOLL, IO_URING };
+
+// Settings parsed from the command line
+struct ServConfig {
+    int portNum;            // Listening port
+    const char* unixPath;   // Unix domain socket to listen on instead (--unix)
+    const char* shmPath;    // Control socket of the shared-memory transport (--shm), else NULL
+    int numWorkers;         // 0 = fork per conx, else size of pre-forked pool
+    int numShards;          // 0 = one listener, else SO_REUSEPORT listeners (one process each)
+    int backlog;            // listen() backlog
+    enum IoEngine ioEngine; // How each process drives its conxs
+    const char* keyDir;     // Key store directory (--keydir), else NULL
+    const char* statsPath;  // File written on SIGUSR1 (--stats), else stderr
+    int maxConns;           // Conxs served at once (fork per conx, or per event loop), 0 = no limit
+    int queueLen;           // Accepted conxs that may wait for a free slot
+    long long deadlineNs;   // Time allowed per request, 0 = none
+    int numThreads;         // Transform threads per process (--threads)
+    long long splitMin;     // Shortest message whose chunks are split among them
+};
+
+// Accepted conxs waiting for a free slot (--queue), oldest first
+struct PendingQueue {
+    int* fds;
+    long long* since;       // When each conx was accepted (ns)
+    int cap;
+    int head;
+    int count;
+};
+
+// Protocol states of a conx, in the order a request moves through them
+enum ConxState {
+    CONX_HANDSHAKE,     // Reading the client type char (or first header byte)
+    CONX_HEADER,        // Reading a request header (header conxs)
+    CONX_REPLY_PERM,    // Writing 'Y'/'P'/'N' permission to connect
+    CONX_LENGTH,        // Reading the 64-bit message length
+    CONX_DATA,          // Reading a chunk of the message
+    CONX_KEY,           // Reading the matching chunk of the key
+    CONX_WRITEBACK,     // Writing the transformed chunk back (then next chunk or length)
+    CONX_UPLOAD,        // Reading a chunk of a pad for the key store
+    CONX_UPLOAD_REPLY,  // Writing the upload status and key ID
+    CONX_KEY_REF,       // Reading the key ID and pad offset of a keyed message
+    CONX_KEY_STATUS,    // Writing whether the pad range was granted
+    CONX_ERROR_REPLY,   // Writing REPLY_ERROR and a status (header conxs), then closing
+    CONX_DONE           // Finished, conx should be closed
+};
+
+// Per-conx protocol state. The engine moves bytes in or out of ioBuff;
+// once ioDone reaches ioLen it calls conxAdvance() for the next step.
+struct Conx {
+    int sockfd;
+    enum ConxState state;
+    char* ioBuff;           // Target of the current read or write
+    int ioLen;              // Bytes expected for the current step
+    int ioDone;             // Bytes transferred so far
+    int isWrite;            // 1 if the current step is a write
+    char cliType;           // Client type of the current request (upper case)
+    char permToConnect;
+    TransformFx transform;  // Kernel for the client type
+    int headerConx;         // 1 if requests start with a ReqHeader (step 9 of otp_proto.h)
+    struct ReqHeader header;        // Current request header (header conxs)
+    int packed;             // 1 if chunks travel in the packed encoding
+    int op;                 // Request op (OP_* in otp_proto.h)
+    unsigned long long msgLen;  // Total message length (network order on the wire)
+    unsigned long long msgLeft; // Chars not yet received
+    int chunkLen;           // Chars in the current chunk
+    int extBuffs;           // 1 if the buffers belong to the engine (conxUseBuffers)
+    struct Slab* slab;      // Buffers borrowed for the current request, else NULL
+    char* fileBuff;         // Chunk buffers (the message is transformed in place)
+    char* keyBuff;
+    unsigned long long keyRef[2];   // Key ID and pad offset of a keyed message
+    const char* padKey;     // Stored pad chars for the next chunk, else NULL
+    struct KeyUpload* upload;       // Pad being uploaded, else NULL
+    char reply[1 + sizeof(unsigned long long)];     // Status char (+ key ID), or error status
+    int failed;             // 1 once an error status was queued; the close drains the socket
+    long long phaseStart;   // When the current stats phase began (ns)
+    long long requestStart; // When the current request or chunk, or the wait for it, began (ns)
+};
+
+// Function Prototypes
+void parseServArgs(int argc, const char* argv[], struct ServConfig* config);
+void runServ(struct ServConfig* config, struct ServMode* mode);
+TransformFx servTransform(struct ServMode* mode, char cliType);
+void runForkPerConx(int servSock, struct ServConfig* config, struct ServMode* mode);
+void runWorkerPool(int servSock, struct ServConfig* config, struct ServMode* mode);
+void runShards(struct ServConfig* config, struct ServMode* mode);
+pid_t spawnWorker(int servSock, int workerIdx, struct ServConfig* config, struct ServMode* mode);
+void serveClient(int sockfd, struct ServConfig* config, struct ServMode* mode);
+int createServSock(struct ServConfig* config);
+int sendData(int sockfd, char* dataToSend, int len);
+int recvAll(int sockfd, char* msgBuff, int len);
+void handleSIGCHLD(int signal);
+void pendingInit(struct PendingQueue* queue, int cap);
+int pendingPush(struct PendingQueue* queue, int sockfd);
+long long pendingExpire(struct PendingQueue* queue, long long deadlineNs);
+int pendingPop(struct PendingQueue* queue, long long deadlineNs);
+void rejectBusy(int sockfd);
+void lingerSock(int sockfd);
+
+// otp_conx.c
+void conxInit(struct Conx* conx, int sockfd);
+void conxUseBuffers(struct Conx* conx, char* fileBuff, char* keyBuff);
+int conxAdvance(struct Conx* conx, struct ServMode* mode);
+void conxFree(struct Conx* conx);
+
+// otp_epoll.c
+void runEpollEngine(int servSock, struct ServConfig* config, struct ServMode* mode);
+
+// otp_uring.c
+void runUringEngine(int servSock, struct ServConfig* config, struct ServMode* mode);
+
+// otp_shm.c
+void runShmListener(int shmSock, struct ServConfig* config, struct ServMode* mode);
+void serveShmSession(int ctrlSock, struct ServMode* mode);
+
+#endif
@@ -0,0 +1,269 @@
+/**********************************************************************************
+ Module Name: otp_shm
+ Description: Daemon side of the shared-memory transport (--shm <path>). The
+     daemon listens on a unix domain control socket at path. A client attaches
+     by connecting and sending its client type char ('E' or 'D') with a sealed
+     memfd holding a ring (see otp_ring.h) as SCM_RIGHTS ancillary data. The
+     daemon checks the type and the ring, replies 'Y' (or 'N'), and then serves
+     the ring with that type's kernel until the client detaches or hangs up the control socket. Each
+     session is served by its own forked process, which sleeps on the ring's
+     futex while the client is idle, so sessions never hold up the daemon's
+     socket conxs; at most --max-conns sessions (else SHM_SESSIONS_MAX) run at
+     once, later clients waiting in the control socket's backlog. The memfd
+     must be sealed against shrinking, so a client cannot make the daemon's
+     mapping fault. The transform runs in place in the shared slot (split
+     among --threads like any other chunk). Each slot counts as one request
+     in the stats.
+ Reference Citation: http://man7.org/linux/man-pages/man7/unix.7.html
+ Reference Citation: http://man7.org/linux/man-pages/man3/cmsg.3.html
+ *********************************************************************************/
+
+#define _GNU_SOURCE     // F_GET_SEALS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "otp_serv.h"
+
+
+/***********************************************************************
+ * Function Name: runShmListener
+ * Description: This function accepts shm clients forever, forking a
+    session process for each. Exited sessions are reaped before every
+    accept and at least every RING_POLL_MS while no client comes, and
+    while the session limit is reached the listener waits for one to
+    exit instead of accepting.
+ **********************************************************************/
+void runShmListener(int shmSock, struct ServConfig* config, struct ServMode* mode)
+{
+    int newClient, numReady, numActive = 0;
+    struct pollfd listenReady;
+    int maxSessions = (config->maxConns > 0) ? config->maxConns : SHM_SESSIONS_MAX;
+    pid_t spawnPid;
+
+    // Sessions are reaped by waitpid() below rather than by a SIGCHLD handler
+    signal(SIGCHLD, SIG_DFL);
+    listenReady.fd = shmSock;
+    listenReady.events = POLLIN;
+
+    // Loop forever
+    while(1)
+    {
+        while(numActive > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+            numActive--;
+        }
+        if(numActive >= maxSessions) {
+            if(waitpid(-1, NULL, 0) > 0) {
+                numActive--;
+            }
+            else if(errno == EINTR) {
+                statsPoll();
+            }
+            continue;
+        }
+
+        numReady = poll(&listenReady, 1, RING_POLL_MS);
+        if(numReady == -1 && errno == EINTR) {
+            statsPoll();
+        }
+        if(numReady != 1) {
+            continue;
+        }
+        newClient = accept(shmSock, NULL, NULL);
+        if(newClient < 0) {
+            if(errno == EINTR) {
+                statsPoll();
+            }
+            else {
+                fprintf(stderr, "%s: error from accept() call.\n", mode->progName);
+            }
+            continue;
+        }
+
+        spawnPid = fork();
+        if(spawnPid == -1) {
+            fprintf(stderr, "Error from fork() call.\n");
+            close(newClient);
+            continue;
+        }
+        if(spawnPid == 0) {     // SESSION
+            close(shmSock);
+            serveShmSession(newClient, mode);
+            exit(0);
+        }
+        numActive++;
+        close(newClient);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: recvAttach
+ * Description: This helper reads the client type char and the ring's
+    memfd sent with it. Returns the fd, or -1 if the client sent no
+    fd (or nothing at all).
+ **********************************************************************/
+static int recvAttach(int ctrlSock, char* cliType)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char cmsgBuff[CMSG_SPACE(sizeof(int))];
+    int ringFd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = cliType;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgBuff;
+    msg.msg_controllen = sizeof(cmsgBuff);
+
+    if(recvmsg(ctrlSock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        return -1;
+    }
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&ringFd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return ringFd;
+}
+
+
+/***********************************************************************
+ * Function Name: mapRing
+ * Description: This helper maps the client's ring after checking that
+    the memfd cannot shrink under the mapping and is as large as the
+    ring it claims to hold. Returns the ring, or NULL if it is unusable;
+    *numSlots and *mapLen are set from the checked values.
+ **********************************************************************/
+static struct RingHeader* mapRing(int ringFd, unsigned int* numSlots, size_t* mapLen)
+{
+    struct stat ringStat;
+    struct RingHeader* header;
+    int seals = fcntl(ringFd, F_GET_SEALS);
+
+    if(seals == -1 || !(seals & F_SEAL_SHRINK) || fstat(ringFd, &ringStat) == -1 ||
+       (size_t) ringStat.st_size < RING_SIZE(1)) {
+        return NULL;
+    }
+    *mapLen = ringStat.st_size;
+    header = mmap(NULL, *mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, ringFd, 0);
+    if(header == MAP_FAILED) {
+        return NULL;
+    }
+
+    // The client may change the header at any time, so read it once
+    *numSlots = __atomic_load_n(&header->numSlots, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&header->magic, __ATOMIC_RELAXED) != RING_MAGIC ||
+       *numSlots < 1 || *numSlots > RING_SLOTS_MAX || *mapLen < RING_SIZE(*numSlots)) {
+        munmap(header, *mapLen);
+        return NULL;
+    }
+    return header;
+}
+
+
+/***********************************************************************
+ * Function Name: clientGone
+ * Description: This helper tells whether the client detached or hung
+    up its control socket.
+ **********************************************************************/
+static int clientGone(int ctrlSock, struct RingHeader* header)
+{
+    struct pollfd ctrlReady;
+
+    ctrlReady.fd = ctrlSock;
+    ctrlReady.events = POLLIN;      // The client never sends after attaching, so this is EOF
+    return __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) ||
+           poll(&ctrlReady, 1, 0) != 0;
+}
+
+
+/***********************************************************************
+ * Function Name: serveShmSession
+ * Description: This function attaches one client's ring and serves it:
+    every submitted slot is transformed in place and marked completed,
+    in ring order. A client that submits more slots than the ring holds
+    breaks the protocol and is dropped.
+ **********************************************************************/
+void serveShmSession(int ctrlSock, struct ServMode* mode)
+{
+    struct RingHeader* header;
+    struct RingSlot* slot;
+    struct timeval attachTimeout = { RING_POLL_MS / 1000, (RING_POLL_MS % 1000) * 1000 };
+    unsigned int numSlots, served = 0, submitted, len;
+    long long startNs;
+    size_t mapLen;
+    char cliType, reply = 'N';
+    TransformFx transform;
+    int ringFd;
+
+    statsCount(STAT_ACCEPTED, 1);
+    setsockopt(ctrlSock, SOL_SOCKET, SO_RCVTIMEO, &attachTimeout, sizeof(attachTimeout));
+    if((ringFd = recvAttach(ctrlSock, &cliType)) == -1) {
+        statsCount(STAT_CLOSED, 1);
+        return;
+    }
+    transform = servTransform(mode, cliType);
+    header = (transform != NULL) ? mapRing(ringFd, &numSlots, &mapLen) : NULL;
+    close(ringFd);      // The mapping keeps the memfd alive
+    if(header != NULL) {
+        reply = 'Y';
+        served = __atomic_load_n(&header->submitted, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&header->completed, served, __ATOMIC_RELEASE);
+    }
+    else {
+        statsCount(STAT_REJECTED, 1);
+    }
+    if(send(ctrlSock, &reply, sizeof(reply), MSG_NOSIGNAL) != 1 || header == NULL) {
+        statsCount(STAT_CLOSED, 1);
+        return;
+    }
+
+    while(1)
+    {
+        submitted = ringWait(&header->submitted, served, &header->daemonWaiting, RING_POLL_MS);
+        if(submitted == served) {       // Idle: see whether the client is still there
+            if(clientGone(ctrlSock, header)) {
+                break;
+            }
+            continue;
+        }
+        if(submitted - served > numSlots) {
+            fprintf(stderr, "%s: shm client overran its ring, dropping it.\n", mode->progName);
+            break;
+        }
+
+        while(served != submitted)
+        {
+            slot = RING_SLOT(header, served % numSlots);
+            len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+            if(len > RING_SLOT_CHARS) {
+                len = RING_SLOT_CHARS;
+            }
+            statsCount(STAT_REQUESTS, 1);
+            startNs = statsNow();
+            tpoolTransform(transform, slot->data, slot->key, slot->data, len, len);
+            statsRecord(PHASE_TRANSFORM, startNs, statsNow());
+            statsCount(STAT_BYTES_IN, 2 * (unsigned long long) len);
+            statsCount(STAT_BYTES_OUT, len);
+            served++;
+            ringPublish(&header->completed, served, &header->clientWaiting);
+        }
+    }
+
+    munmap(header, mapLen);
+    statsCount(STAT_CLOSED, 1);
+}
@@ -0,0 +1,72 @@
+/**********************************************************************************
+ Module Name: otp_slab
+ Description: Chunk buffer pool of the OTP daemons. See otp_slab.h. Each slab
+     is one allocation: the Slab record on its own cache line, then the message
+     buffer and the key buffer, each rounded up to whole cache lines.
+ Reference Citation: http://man7.org/linux/man-pages/man3/posix_memalign.3.html
+ *********************************************************************************/
+
+#include <stdlib.h>
+#include "otp_slab.h"
+
+#define SLAB_STRIDE(chars) ((((chars) + 1) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN)
+
+// Free slabs of each class
+static struct {
+    struct Slab* free;
+    int numFree;
+} slabClasses[SLAB_CLASSES];
+
+
+/***********************************************************************
+ * Function Name: slabGet
+ * Description: This function lends out a slab whose buffers hold at
+    least chars chars (at most CHUNK_SIZE), reusing a free one of the
+    smallest class that fits. Returns NULL if out of memory.
+ **********************************************************************/
+struct Slab* slabGet(int chars)
+{
+    struct Slab* slab;
+    void* mem;
+    int classIdx = 0;
+
+    while(classIdx < SLAB_CLASSES - 1 && (SLAB_MIN_CHARS << classIdx) < chars) {
+        classIdx++;
+    }
+
+    if((slab = slabClasses[classIdx].free) != NULL) {
+        slabClasses[classIdx].free = slab->next;
+        slabClasses[classIdx].numFree--;
+        return slab;
+    }
+
+    chars = SLAB_MIN_CHARS << classIdx;
+    if(posix_memalign(&mem, SLAB_ALIGN, SLAB_ALIGN + 2 * SLAB_STRIDE(chars)) != 0) {
+        return NULL;
+    }
+    slab = mem;
+    slab->classIdx = classIdx;
+    slab->chars = chars;
+    slab->fileBuff = (char*) mem + SLAB_ALIGN;
+    slab->keyBuff = slab->fileBuff + SLAB_STRIDE(chars);
+    return slab;
+}
+
+
+/***********************************************************************
+ * Function Name: slabPut
+ * Description: This function takes back a slab, keeping it for reuse
+    unless its class already holds SLAB_CACHE_BYTES of free slabs.
+ **********************************************************************/
+void slabPut(struct Slab* slab)
+{
+    int classIdx = slab->classIdx;
+
+    if((long) (slabClasses[classIdx].numFree + 1) * 2 * SLAB_STRIDE(slab->chars) > SLAB_CACHE_BYTES) {
+        free(slab);
+        return;
+    }
+    slab->next = slabClasses[classIdx].free;
+    slabClasses[classIdx].free = slab;
+    slabClasses[classIdx].numFree++;
+}
@@ -0,0 +1,38 @@
+#ifndef otp_slab_h
+#define otp_slab_h
+/**********************************************************************************
+ Module Name: otp_slab
+ Description: Chunk buffer pool of the OTP daemons. A conx borrows one slab (a
+     message buffer and a key buffer, back to back) when a request's length is
+     known and returns it once the request is done, so an idle keep-alive conx
+     holds no buffers and a busy process only allocates until its pool has
+     warmed up. Slabs come in power-of-two size classes from SLAB_MIN_CHARS to
+     CHUNK_SIZE chars per buffer, each class with its own free list, so a
+     10-char message borrows a small slab instead of a chunk-sized one. A
+     class keeps at most SLAB_CACHE_BYTES of free slabs; slabs returned beyond
+     that are freed. The pool belongs to the process (one per daemon process,
+     used only by the thread that drives its conxs), so it needs no locking.
+ Reference Citation: "The Slab Allocator: An Object-Caching Kernel Memory Allocator", Jeff Bonwick, USENIX Summer 1994
+ *********************************************************************************/
+
+#include "otp_proto.h"
+
+#define SLAB_MIN_CHARS 256          // Smallest class (chars per buffer)
+#define SLAB_CLASSES 9              // SLAB_MIN_CHARS << 0 .. 8 = CHUNK_SIZE
+#define SLAB_ALIGN 64               // Buffers start on cache lines
+#define SLAB_CACHE_BYTES (4 * 1024 * 1024)  // Free slabs kept per class
+
+// Message and key buffer of one request, each holding chars chars plus one
+struct Slab {
+    struct Slab* next;      // Free list link
+    int classIdx;
+    int chars;
+    char* fileBuff;
+    char* keyBuff;
+};
+
+// Function Prototypes
+struct Slab* slabGet(int chars);
+void slabPut(struct Slab* slab);
+
+#endif
@@ -0,0 +1,266 @@
+/**********************************************************************************
+ Module Name: otp_stats
+ Description: In-process daemon metrics. See otp_stats.h.
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "otp_stats.h"
+
+static const char* counterNames[STAT_COUNTERS] = {
+    "otp_conxs_accepted_total", "otp_conxs_closed_total", "otp_clients_rejected_total",
+    "otp_requests_total", "otp_bytes_in_total", "otp_bytes_out_total",
+    "otp_conxs_busy_total", "otp_conxs_expired_total"
+};
+static const char* phaseNames[STAT_PHASES] = {
+    "accept", "handshake", "receive", "transform", "sendback"
+};
+
+static struct StatsSlot localSlot;          // Used until statsInit() maps the table
+static struct StatsSlot* statsTable = NULL;
+static struct StatsSlot* mySlot = &localSlot;
+static const char* statsProg = "otp";
+static const char* statsPath = NULL;        // Dump file, else stderr
+static int listeners[STATS_LISTENERS_MAX];
+static int numListeners = 0;
+static volatile sig_atomic_t dumpRequested = 0;
+
+
+/***********************************************************************
+ * Function Name: handleSIGUSR1
+ * Description: This handler only flags the dump request; the dump is
+    written by statsPoll() outside of signal context.
+ **********************************************************************/
+static void handleSIGUSR1(int signal)
+{
+    dumpRequested = 1;
+}
+
+
+/***********************************************************************
+ * Function Name: statsInit
+ * Description: This function maps the shared slot table and installs
+    the SIGUSR1 handler. It must run before the daemon forks, so every
+    process inherits the same table. The handler is installed without
+    SA_RESTART so the signal interrupts the main process's blocking
+    call (accept(), wait(), epoll_wait()...), which then calls
+    statsPoll().
+ **********************************************************************/
+void statsInit(const char* progName, const char* dumpPath)
+{
+    struct sigaction SIGUSR1_action;
+
+    statsProg = progName;
+    statsPath = dumpPath;
+
+    statsTable = mmap(NULL, STATS_SLOTS * sizeof(struct StatsSlot), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(statsTable == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map stats table.\n", progName);
+        exit(1);
+    }
+    mySlot = &statsTable[0];
+
+    memset(&SIGUSR1_action, 0, sizeof(SIGUSR1_action));
+    SIGUSR1_action.sa_handler = handleSIGUSR1;
+    SIGUSR1_action.sa_flags = 0;
+    sigaction(SIGUSR1, &SIGUSR1_action, NULL);
+}
+
+
+/***********************************************************************
+ * Function Name: statsUseSlot
+ * Description: This function makes the calling process (a freshly
+    forked worker or shard) update its own slot from now on.
+ **********************************************************************/
+void statsUseSlot(int slotIdx)
+{
+    if(statsTable != NULL && slotIdx >= 0 && slotIdx < STATS_SLOTS) {
+        mySlot = &statsTable[slotIdx];
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: statsAddListener
+ * Description: This function registers a listening socket whose accept
+    queue depth is reported by the dump.
+ **********************************************************************/
+void statsAddListener(int sockfd)
+{
+    if(numListeners < STATS_LISTENERS_MAX) {
+        listeners[numListeners++] = sockfd;
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: statsNow
+ * Description: This function returns a monotonic timestamp in ns.
+ **********************************************************************/
+long long statsNow(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/***********************************************************************
+ * Function Name: statsCount
+ * Description: This function adds n to a counter of this process's slot.
+ **********************************************************************/
+void statsCount(enum StatCounter counter, unsigned long long n)
+{
+    __atomic_fetch_add(&mySlot->counters[counter], n, __ATOMIC_RELAXED);
+}
+
+
+/***********************************************************************
+ * Function Name: statsRecord
+ * Description: This function adds one phase duration to the histogram
+    of this process's slot.
+ **********************************************************************/
+void statsRecord(enum StatPhase phase, long long startNs, long long endNs)
+{
+    struct StatHistogram* hist = &mySlot->phases[phase];
+    unsigned long long ns = (endNs > startNs) ? (unsigned long long) (endNs - startNs) : 0;
+    int bucket = (63 - __builtin_clzll(ns | 1)) - STATS_MIN_SHIFT + 1;
+
+    if(bucket < 0) {
+        bucket = 0;
+    }
+    if(bucket >= STATS_BUCKETS) {
+        bucket = STATS_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sumNs, ns, __ATOMIC_RELAXED);
+}
+
+
+/***********************************************************************
+ * Function Name: statsPoll
+ * Description: This function writes the dump if SIGUSR1 arrived since
+    the last call. Loops call it after a syscall returns EINTR.
+ **********************************************************************/
+void statsPoll(void)
+{
+    if(dumpRequested) {
+        dumpRequested = 0;
+        statsDump();
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: acceptQueueDepth
+ * Description: This helper returns the number of conxs waiting in the
+    accept queues of the registered TCP listeners (TCP_INFO reports it
+    as tcpi_unacked for a listening socket). Unix listeners are skipped.
+ **********************************************************************/
+static unsigned long long acceptQueueDepth(void)
+{
+    struct tcp_info info;
+    socklen_t infoLen;
+    unsigned long long depth = 0;
+    int i;
+
+    for(i = 0; i < numListeners; i++) {
+        infoLen = sizeof(info);
+        if(getsockopt(listeners[i], IPPROTO_TCP, TCP_INFO, &info, &infoLen) == 0 &&
+           info.tcpi_state == TCP_LISTEN) {
+            depth += info.tcpi_unacked;
+        }
+    }
+    return depth;
+}
+
+
+/***********************************************************************
+ * Function Name: statsDump
+ * Description: This function sums every slot and writes the result in
+    the Prometheus text format, to a temp file renamed over statsPath
+    (so readers never see a partial dump) or to stderr.
+ **********************************************************************/
+void statsDump(void)
+{
+    struct StatsSlot total;
+    struct StatsSlot* slot;
+    unsigned long long cumulative;
+    char tmpPath[PATH_MAX];
+    FILE* out = stderr;
+    int s, c, p, b;
+
+    // Sum every slot (only the main process's when the table is not shared)
+    memset(&total, 0, sizeof(total));
+    for(s = 0; s < ((statsTable != NULL) ? STATS_SLOTS : 1); s++) {
+        slot = (statsTable != NULL) ? &statsTable[s] : &localSlot;
+        for(c = 0; c < STAT_COUNTERS; c++) {
+            total.counters[c] += __atomic_load_n(&slot->counters[c], __ATOMIC_RELAXED);
+        }
+        for(p = 0; p < STAT_PHASES; p++) {
+            for(b = 0; b < STATS_BUCKETS; b++) {
+                total.phases[p].buckets[b] += __atomic_load_n(&slot->phases[p].buckets[b], __ATOMIC_RELAXED);
+            }
+            total.phases[p].sumNs += __atomic_load_n(&slot->phases[p].sumNs, __ATOMIC_RELAXED);
+        }
+    }
+
+    if(statsPath != NULL) {
+        snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", statsPath, (int) getpid());
+        if((out = fopen(tmpPath, "w")) == NULL) {
+            fprintf(stderr, "%s: cannot write stats to %s\n", statsProg, tmpPath);
+            return;
+        }
+    }
+
+    for(c = 0; c < STAT_COUNTERS; c++) {
+        fprintf(out, "# TYPE %s counter\n%s{daemon=\"%s\"} %llu\n",
+                counterNames[c], counterNames[c], statsProg, total.counters[c]);
+    }
+    fprintf(out, "# TYPE otp_conxs_active gauge\notp_conxs_active{daemon=\"%s\"} %llu\n",
+            statsProg, total.counters[STAT_ACCEPTED] - total.counters[STAT_CLOSED]);
+    fprintf(out, "# TYPE otp_accept_queue_depth gauge\notp_accept_queue_depth{daemon=\"%s\"} %llu\n",
+            statsProg, acceptQueueDepth());
+
+    fprintf(out, "# TYPE otp_phase_seconds histogram\n");
+    for(p = 0; p < STAT_PHASES; p++) {
+        cumulative = 0;
+        for(b = 0; b < STATS_BUCKETS; b++) {
+            cumulative += total.phases[p].buckets[b];
+            if(b < STATS_BUCKETS - 1) {
+                fprintf(out, "otp_phase_seconds_bucket{daemon=\"%s\",phase=\"%s\",le=\"%.9g\"} %llu\n",
+                        statsProg, phaseNames[p], (double) (1ULL << (b + STATS_MIN_SHIFT)) / 1e9, cumulative);
+            }
+            else {
+                fprintf(out, "otp_phase_seconds_bucket{daemon=\"%s\",phase=\"%s\",le=\"+Inf\"} %llu\n",
+                        statsProg, phaseNames[p], cumulative);
+            }
+        }
+        fprintf(out, "otp_phase_seconds_sum{daemon=\"%s\",phase=\"%s\"} %.9f\n",
+                statsProg, phaseNames[p], (double) total.phases[p].sumNs / 1e9);
+        fprintf(out, "otp_phase_seconds_count{daemon=\"%s\",phase=\"%s\"} %llu\n",
+                statsProg, phaseNames[p], cumulative);
+    }
+
+    if(out != stderr) {
+        if(fclose(out) != 0 || rename(tmpPath, statsPath) == -1) {
+            fprintf(stderr, "%s: cannot write stats to %s\n", statsProg, statsPath);
+            unlink(tmpPath);
+        }
+    }
+    else {
+        fflush(out);
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef otp_stats_h
+#define otp_stats_h
+/**********************************************************************************
+ Module Name: otp_stats
+ Description: In-process metrics of the OTP daemons. Every process of a daemon
+     (pool worker, shard, or the listening process together with its forked
+     children) updates its own slot of a table kept in one MAP_SHARED anonymous
+     mapping set up before the first fork(). Updates are relaxed atomic adds to
+     the process's own slot, so the hot path takes no lock and workers do not
+     share cache lines; a reader sums all slots.
+     Besides counters (conxs, rejected clients, requests, bytes, busy replies,
+     missed deadlines) each slot holds
+     a latency histogram for every request phase, with power-of-two buckets
+     from 1us up:
+       - accept: conx accepted until its client type char arrived
+       - handshake: client type char until the permission reply was sent
+       - receive: length word (or previous chunk sent back) until a whole
+         chunk (message plus key) arrived
+       - transform: the codec kernel run on one chunk
+       - sendback: transformed chunk queued until fully written
+     Sending SIGUSR1 to the daemon's main process writes the aggregate in the
+     Prometheus text format to the --stats <path> file (replaced atomically),
+     or to stderr without --stats. The dump also reports the current accept
+     queue depth of the daemon's TCP listeners.
+ Reference Citation: https://prometheus.io/docs/instrumenting/exposition_formats/
+ Reference Citation: http://man7.org/linux/man-pages/man7/tcp.7.html
+ *********************************************************************************/
+
+#define STATS_SLOTS 257         // Main process (and its children) + one per worker or shard
+#define STATS_BUCKETS 24        // Histogram buckets (the last one is unbounded)
+#define STATS_MIN_SHIFT 10      // First bucket holds phases under 2^10 ns
+#define STATS_LISTENERS_MAX 256
+
+// Counters kept per slot
+enum StatCounter {
+    STAT_ACCEPTED,      // Conxs accepted
+    STAT_CLOSED,        // Conxs closed
+    STAT_REJECTED,      // Clients refused at the handshake
+    STAT_REQUESTS,      // Requests (messages, uploads, keyed messages) started
+    STAT_BYTES_IN,
+    STAT_BYTES_OUT,
+    STAT_BUSY,          // Conxs turned away with a busy reply
+    STAT_EXPIRED,       // Conxs closed for missing their deadline
+    STAT_COUNTERS
+};
+
+// Request phases with a latency histogram
+enum StatPhase {
+    PHASE_ACCEPT,
+    PHASE_HANDSHAKE,
+    PHASE_RECEIVE,
+    PHASE_TRANSFORM,
+    PHASE_SENDBACK,
+    STAT_PHASES
+};
+
+struct StatHistogram {
+    unsigned long long buckets[STATS_BUCKETS];
+    unsigned long long sumNs;
+};
+
+// Metrics of one process, on cache lines of its own
+struct StatsSlot {
+    unsigned long long counters[STAT_COUNTERS];
+    struct StatHistogram phases[STAT_PHASES];
+} __attribute__((aligned(64)));
+
+// Function Prototypes
+void statsInit(const char* progName, const char* dumpPath);
+void statsUseSlot(int slotIdx);
+void statsAddListener(int sockfd);
+long long statsNow(void);
+void statsCount(enum StatCounter counter, unsigned long long n);
+void statsRecord(enum StatPhase phase, long long startNs, long long endNs);
+void statsPoll(void);
+void statsDump(void);
+
+#endif
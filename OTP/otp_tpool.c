@@ -0,0 +1,204 @@
+/**********************************************************************************
+ Module Name: otp_tpool
+ Description: Transform thread pool of the OTP daemons. See otp_tpool.h.
+     One job (a chunk) is in flight at a time, since every daemon process drives
+     its conxs from one thread. The caller publishes the job and bumps a
+     generation counter; each helper runs its slice when it sees a new
+     generation and then acknowledges it, and the caller returns once its own
+     slice is done and every helper has acknowledged.
+ Reference Citation: http://man7.org/linux/man-pages/man7/pthreads.7.html
+ *********************************************************************************/
+
+#define _GNU_SOURCE     // sched_getaffinity() and CPU_COUNT()
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include "otp_tpool.h"
+
+// Pool shared by the calling thread and its helpers
+static struct {
+    int numThreads;             // Including the calling thread
+    long long splitMin;         // Shortest message split across threads
+    int started;                // 1 once the helpers are running
+    pthread_mutex_t lock;       // Guards sleeping helpers
+    pthread_cond_t wake;
+    TransformFx transform;      // Current job
+    const char* data;
+    const char* key;
+    char* outBuff;
+    size_t len;
+    size_t sliceLen;
+    unsigned long generation;   // Bumped for every job
+    int acksLeft;               // Helpers yet to finish the current job
+} pool = { 1, TPOOL_SPLIT_MIN_DEFAULT, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+
+/***********************************************************************
+ * Function Name: cpuRelax
+ * Description: This helper tells the CPU the caller is spinning.
+ **********************************************************************/
+static inline void cpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+/***********************************************************************
+ * Function Name: runSlice
+ * Description: This helper transforms slice number idx of the current
+    job, if the job has that many slices.
+ **********************************************************************/
+static void runSlice(int idx)
+{
+    size_t start = idx * pool.sliceLen;
+
+    if(start < pool.len) {
+        pool.transform(pool.data + start, pool.key + start, pool.outBuff + start,
+                       (pool.len - start < pool.sliceLen) ? pool.len - start : pool.sliceLen);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: helperLoop
+ * Description: This function is the body of one helper thread: wait for
+    a new job (spinning first, then sleeping), run its slice, and
+    acknowledge the job.
+ **********************************************************************/
+static void* helperLoop(void* arg)
+{
+    int idx = (int) (long) arg, spins;
+    unsigned long seen = 0;
+
+    while(1)
+    {
+        for(spins = 0; spins < TPOOL_SPIN && __atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE) == seen; spins++) {
+            cpuRelax();
+        }
+        if(__atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE) == seen) {
+            pthread_mutex_lock(&pool.lock);
+            while(__atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE) == seen) {
+                pthread_cond_wait(&pool.wake, &pool.lock);
+            }
+            pthread_mutex_unlock(&pool.lock);
+        }
+
+        seen++;     // The caller waits for every ack, so jobs never skip ahead
+        runSlice(idx);
+        __atomic_fetch_sub(&pool.acksLeft, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+
+/***********************************************************************
+ * Function Name: startHelpers
+ * Description: This function starts the helper threads, no more than
+    the CPUs the process may run on (spinning threads sharing a CPU only
+    slow each other down). They block every signal, so signals meant for
+    the daemon (SIGUSR1, SIGALRM, SIGCHLD) keep interrupting the thread
+    that drives the conxs. If a helper cannot be started, the pool runs
+    with the ones that did.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/sched_setaffinity.2.html
+ **********************************************************************/
+static void startHelpers(void)
+{
+    pthread_t thread;
+    sigset_t allSignals, oldMask;
+    cpu_set_t cpus;
+    int i;
+
+    if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) < pool.numThreads) {
+        pool.numThreads = CPU_COUNT(&cpus);
+    }
+
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_SETMASK, &allSignals, &oldMask);
+    for(i = 1; i < pool.numThreads; i++) {
+        if(pthread_create(&thread, NULL, helperLoop, (void*) (long) i) != 0) {
+            fprintf(stderr, "Error creating transform thread, using %d.\n", i);
+            pool.numThreads = i;
+            break;
+        }
+        pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+    pool.started = 1;
+}
+
+
+/***********************************************************************
+ * Function Name: tpoolConfig
+ * Description: This function sets the number of transform threads and
+    the message length from which chunks are split among them. It must
+    be called before the first tpoolTransform().
+ **********************************************************************/
+void tpoolConfig(int numThreads, long long splitMin)
+{
+    pool.numThreads = numThreads;
+    pool.splitMin = splitMin;
+}
+
+
+/***********************************************************************
+ * Function Name: tpoolTransform
+ * Description: This function runs transform over len chars, a chunk of
+    a message of msgLen chars. Chunks of large enough messages are split
+    into cache-aligned slices shared among the pool's threads; the
+    caller takes the first slice and returns once all are done.
+ **********************************************************************/
+void tpoolTransform(TransformFx transform, const char* data, const char* key, char* outBuff,
+                    size_t len, unsigned long long msgLen)
+{
+    size_t sliceLen;
+    int spins;
+
+    if(pool.numThreads < 2 || msgLen < (unsigned long long) pool.splitMin || len < 2 * TPOOL_SLICE_MIN) {
+        transform(data, key, outBuff, len);
+        return;
+    }
+    if(!pool.started) {
+        startHelpers();
+        if(pool.numThreads < 2) {
+            transform(data, key, outBuff, len);
+            return;
+        }
+    }
+
+    // Split evenly, rounding slices up to whole cache lines
+    sliceLen = (len + pool.numThreads - 1) / pool.numThreads;
+    if(sliceLen < TPOOL_SLICE_MIN) {
+        sliceLen = TPOOL_SLICE_MIN;
+    }
+    sliceLen = (sliceLen + TPOOL_ALIGN - 1) & ~((size_t) TPOOL_ALIGN - 1);
+
+    pool.transform = transform;
+    pool.data = data;
+    pool.key = key;
+    pool.outBuff = outBuff;
+    pool.len = len;
+    pool.sliceLen = sliceLen;
+    pool.acksLeft = pool.numThreads - 1;
+
+    // Publish the job, waking any helper that went to sleep
+    pthread_mutex_lock(&pool.lock);
+    __atomic_fetch_add(&pool.generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    runSlice(0);
+
+    // Helpers are normally done by now; yield the CPU if they are not
+    for(spins = 0; __atomic_load_n(&pool.acksLeft, __ATOMIC_ACQUIRE) > 0; spins++) {
+        if(spins < TPOOL_SPIN) {
+            cpuRelax();
+        }
+        else {
+            sched_yield();
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef otp_tpool_h
+#define otp_tpool_h
+/**********************************************************************************
+ Module Name: otp_tpool
+ Description: Transform thread pool of the OTP daemons. With --threads N, every
+     chunk of a message of at least --split-min chars is transformed by N threads
+     at once (the calling thread and N - 1 helpers), each running the codec on
+     one contiguous slice of the chunk. Slices start on cache line boundaries, so
+     no two threads write the same line of the output buffer. Smaller messages,
+     and chunks too short to be worth splitting, are transformed inline as
+     before. The pool never runs more threads than the CPUs the process may
+     use. The helpers are started on first use, in the process that uses
+     them; every daemon process only forks before serving its first message, so
+     no process ever forks with helpers running. Helpers spin briefly after each
+     slice, since the next chunk of a large message usually follows at once,
+     then sleep until new work arrives.
+ Reference Citation: "The Linux Programming Interface", Michael Kerrisk, ISBN: 9781593272203
+ *********************************************************************************/
+
+#include <stddef.h>
+#include "otp_codec.h"
+
+#define TPOOL_THREADS_MAX 64        // Upper bound for --threads
+#define TPOOL_SPLIT_MIN_DEFAULT (1 << 20)   // Messages split by default from 1 MiB
+#define TPOOL_SLICE_MIN 8192        // Shortest slice handed to a thread
+#define TPOOL_ALIGN 64              // Slice boundaries (cache line size)
+#define TPOOL_SPIN 20000            // Polls of a helper before it sleeps
+
+// Function Prototypes
+void tpoolConfig(int numThreads, long long splitMin);
+void tpoolTransform(TransformFx transform, const char* data, const char* key, char* outBuff,
+                    size_t len, unsigned long long msgLen);
+
+#endif
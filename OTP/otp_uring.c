@@ -0,0 +1,411 @@
+/**********************************************************************************
+ Module Name: otp_uring
+ Description: io_uring I/O engine for the OTP daemons (--io=uring). Like the epoll
+     engine, one process drives many conxs through the shared state machine
+     (otp_conx.c), but instead of a readiness syscall plus one recv()/send() per
+     step, every accept, read and write is queued on a submission ring and one
+     io_uring_enter() call both submits the whole batch and reaps completions.
+     Each conx lives in a fixed slot of one arena that also holds its chunk
+     buffers. The arena is registered with the kernel once, so reads and writes
+     use READ_FIXED/WRITE_FIXED and skip per-op page pinning (if registration is
+     refused, e.g. by RLIMIT_MEMLOCK, plain READ/WRITE are used instead). A
+     process serves at most URING_CONX_MAX (or --max-conns) conxs at a time;
+     accept() stays armed, and conxs beyond that wait in the pending queue or
+     are turned away as busy. A periodic TIMEOUT op wakes the loop to shut down
+     conxs past their deadline, which completes their in-flight op. The ring is
+     driven with raw syscalls, so no liburing is needed.
+ Reference Citation: https://kernel.dk/io_uring.pdf
+ Reference Citation: http://man7.org/linux/man-pages/man7/io_uring.7.html
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include "otp_serv.h"
+
+#define URING_ACCEPT_TAG 0ULL               // user_data of the pending accept
+#define URING_IGNORE_TAG (~0ULL)            // user_data of closes (result unused)
+#define URING_TIMER_TAG (~0ULL - 1)         // user_data of the deadline sweep timer
+#define URING_SWEEP_MAX 1000000000LL        // Longest sweep period (ns)
+
+// One conx and its chunk buffers, laid out back to back in the arena
+struct UringSlot {
+    struct Conx conx;
+    int inUse;
+    int expired;                // 1 once shut down for running past its deadline
+    char fileBuff[CHUNK_SIZE + 1];
+    char keyBuff[CHUNK_SIZE + 1];
+};
+
+// Userspace view of the kernel's rings
+struct Uring {
+    int ringFd;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    unsigned sqPending;         // SQEs queued since the last enter
+    int fixedBuffs;             // 1 if the arena is registered
+};
+
+// Function Prototypes (local to the engine)
+static void uringSetup(struct Uring* ring, struct UringSlot* arena, struct ServMode* mode);
+static struct io_uring_sqe* uringGetSqe(struct Uring* ring);
+static void queueAccept(struct Uring* ring, int servSock);
+static void queueTimer(struct Uring* ring, struct __kernel_timespec* period);
+static void queueConxIo(struct Uring* ring, struct UringSlot* arena, int slotIdx);
+static void startSlot(struct Uring* ring, struct UringSlot* arena, int sockfd);
+static void sweepSlots(struct UringSlot* arena, long long deadlineNs);
+static void releaseSlot(struct Uring* ring, struct UringSlot* slot);
+
+
+/***********************************************************************
+ * Function Name: runUringEngine
+ * Description: This function runs the io_uring loop forever. Every
+    completion either accepts a conx into a free slot or moves bytes
+    for one conx, advancing its state machine once a step is complete
+    and queueing the conx's next read or write. Conxs accepted while all
+    slotLimit slots are busy are queued, and get a slot as one is freed.
+ **********************************************************************/
+void runUringEngine(int servSock, struct ServConfig* config, struct ServMode* mode)
+{
+    struct Uring ring;
+    struct UringSlot* arena;
+    struct UringSlot* slot;
+    struct io_uring_cqe* cqe;
+    struct PendingQueue pending;
+    struct __kernel_timespec sweepPeriod;
+    long long sweepNs;
+    unsigned long long tag;
+    int result, slotIdx, numActive = 0, acceptArmed = 0, slotLimit;
+    unsigned cqHead;
+
+    slotLimit = (config->maxConns > 0 && config->maxConns < URING_CONX_MAX) ?
+                config->maxConns : URING_CONX_MAX;
+    pendingInit(&pending, config->queueLen);
+
+    // A peer hanging up mid-write must not kill the daemon (writes use write(2))
+    signal(SIGPIPE, SIG_IGN);
+
+    arena = mmap(NULL, URING_CONX_MAX * sizeof(struct UringSlot), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(arena == MAP_FAILED) {
+        fprintf(stderr, "%s: out of memory.\n", mode->progName);
+        exit(1);
+    }
+    uringSetup(&ring, arena, mode);
+
+    // Deadlines are checked a few times per deadline, at least once a second
+    if(config->deadlineNs > 0) {
+        sweepNs = config->deadlineNs / 4;
+        if(sweepNs > URING_SWEEP_MAX) {
+            sweepNs = URING_SWEEP_MAX;
+        }
+        sweepPeriod.tv_sec = sweepNs / 1000000000LL;
+        sweepPeriod.tv_nsec = sweepNs % 1000000000LL;
+        queueTimer(&ring, &sweepPeriod);
+    }
+
+    // Loop forever
+    while(1)
+    {
+        if(!acceptArmed) {
+            queueAccept(&ring, servSock);
+            acceptArmed = 1;
+        }
+
+        // Submit everything queued and wait for at least one completion
+        if(syscall(__NR_io_uring_enter, ring.ringFd, ring.sqPending, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+            if(errno == EINTR) {    // SIGUSR1 may have asked for a stats dump
+                statsPoll();
+                continue;
+            }
+            fprintf(stderr, "%s: error from io_uring_enter() call.\n", mode->progName);
+            exit(1);
+        }
+        ring.sqPending = 0;
+
+        // Reap every completion available
+        cqHead = *ring.cqHead;
+        while(cqHead != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE))
+        {
+            cqe = &ring.cqes[cqHead & *ring.cqMask];
+            tag = cqe->user_data;
+            result = cqe->res;
+            cqHead++;
+            __atomic_store_n(ring.cqHead, cqHead, __ATOMIC_RELEASE);
+
+            if(tag == URING_IGNORE_TAG) {
+                continue;
+            }
+
+            if(tag == URING_TIMER_TAG) {    // Sweep for expired conxs and queue entries
+                if(result != -ETIME) {
+                    fprintf(stderr, "%s: io_uring timeouts not supported, deadlines disabled.\n", mode->progName);
+                    continue;
+                }
+                sweepSlots(arena, config->deadlineNs);
+                pendingExpire(&pending, config->deadlineNs);
+                queueTimer(&ring, &sweepPeriod);
+                continue;
+            }
+
+            if(tag == URING_ACCEPT_TAG) {   // New conx, place it in a free slot or queue it
+                acceptArmed = 0;
+                if(result < 0) {
+                    if(result != -EINTR && result != -ECONNABORTED) {
+                        fprintf(stderr, "%s: error from accept() call.\n", mode->progName);
+                    }
+                    continue;
+                }
+                if(numActive < slotLimit) {
+                    startSlot(&ring, arena, result);
+                    numActive++;
+                }
+                else if(pendingPush(&pending, result) == -1) {
+                    rejectBusy(result);
+                }
+                continue;
+            }
+
+            // Read or write finished for one conx
+            slotIdx = (int) (tag - 1);
+            slot = &arena[slotIdx];
+            if((result == -EINTR || result == -EAGAIN) && !slot->expired) {
+                queueConxIo(&ring, arena, slotIdx);     // Retry the same step
+                continue;
+            }
+            if(result > 0 && !slot->expired) {
+                slot->conx.ioDone += result;
+                result = 0;
+                while(result == 0 && slot->conx.ioDone >= slot->conx.ioLen) {
+                    result = conxAdvance(&slot->conx, mode);
+                }
+                if(result == 0) {
+                    queueConxIo(&ring, arena, slotIdx);
+                    continue;
+                }
+            }
+
+            // Peer hung up, errored or expired mid-request, or the conx is done
+            releaseSlot(&ring, slot);
+            numActive--;
+            if((result = pendingPop(&pending, config->deadlineNs)) != -1) {
+                startSlot(&ring, arena, result);
+                numActive++;
+            }
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: uringSetup
+ * Description: This function creates the ring, maps its submission and
+    completion queues and registers the conx arena as one fixed buffer.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/io_uring_setup.2.html
+ **********************************************************************/
+static void uringSetup(struct Uring* ring, struct UringSlot* arena, struct ServMode* mode)
+{
+    struct io_uring_params params;
+    struct iovec arenaVec;
+    size_t sqRingLen, cqRingLen;
+    char *sqRing, *cqRing;
+
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(struct Uring));
+    if((ring->ringFd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) == -1) {
+        fprintf(stderr, "%s: io_uring is not available (io_uring_setup() failed).\n", mode->progName);
+        exit(1);
+    }
+
+    // Map the rings (one mapping serves both when the kernel allows it)
+    sqRingLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingLen = cqRingLen = (sqRingLen > cqRingLen) ? sqRingLen : cqRingLen;
+    }
+    sqRing = mmap(NULL, sqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring->ringFd, IORING_OFF_SQ_RING);
+    cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing :
+             mmap(NULL, cqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring->ringFd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+    if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map io_uring queues.\n", mode->progName);
+        exit(1);
+    }
+
+    ring->sqHead = (unsigned*) (sqRing + params.sq_off.head);
+    ring->sqTail = (unsigned*) (sqRing + params.sq_off.tail);
+    ring->sqMask = (unsigned*) (sqRing + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sqRing + params.sq_off.array);
+    ring->cqHead = (unsigned*) (cqRing + params.cq_off.head);
+    ring->cqTail = (unsigned*) (cqRing + params.cq_off.tail);
+    ring->cqMask = (unsigned*) (cqRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cqRing + params.cq_off.cqes);
+
+    // Register the whole arena as fixed buffer 0
+    arenaVec.iov_base = arena;
+    arenaVec.iov_len = URING_CONX_MAX * sizeof(struct UringSlot);
+    ring->fixedBuffs = (syscall(__NR_io_uring_register, ring->ringFd, IORING_REGISTER_BUFFERS, &arenaVec, 1) == 0);
+    if(!ring->fixedBuffs) {
+        fprintf(stderr, "%s: io_uring buffer registration refused, using unregistered buffers.\n", mode->progName);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: uringGetSqe
+ * Description: This helper returns the next free submission entry,
+    cleared and already published in the SQ array. If the queue is
+    full, the queued entries are submitted first.
+ **********************************************************************/
+static struct io_uring_sqe* uringGetSqe(struct Uring* ring)
+{
+    unsigned tail = *ring->sqTail;
+    struct io_uring_sqe* sqe;
+
+    if(tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) > *ring->sqMask) {
+        syscall(__NR_io_uring_enter, ring->ringFd, ring->sqPending, 0, 0, NULL, 0);
+        ring->sqPending = 0;
+    }
+
+    sqe = &ring->sqes[tail & *ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[tail & *ring->sqMask] = tail & *ring->sqMask;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->sqPending++;
+    return sqe;
+}
+
+
+/***********************************************************************
+ * Function Name: queueAccept
+ * Description: This function queues an accept on the listening socket.
+ **********************************************************************/
+static void queueAccept(struct Uring* ring, int servSock)
+{
+    struct io_uring_sqe* sqe = uringGetSqe(ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = servSock;
+    sqe->user_data = URING_ACCEPT_TAG;
+}
+
+
+/***********************************************************************
+ * Function Name: queueTimer
+ * Description: This function queues a timeout that completes after one
+    sweep period. The kernel copies the period when the op is submitted.
+ * Reference Citation: http://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+ **********************************************************************/
+static void queueTimer(struct Uring* ring, struct __kernel_timespec* period)
+{
+    struct io_uring_sqe* sqe = uringGetSqe(ring);
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long) period;
+    sqe->len = 1;
+    sqe->off = 0;           // Complete on the timeout only, not after N completions
+    sqe->user_data = URING_TIMER_TAG;
+}
+
+
+/***********************************************************************
+ * Function Name: queueConxIo
+ * Description: This function queues the read or write of the rest of
+    a conx's current step. The conx's ioBuff always points into the
+    arena (its own fields or chunk buffers), so fixed buffer 0 covers it.
+ **********************************************************************/
+static void queueConxIo(struct Uring* ring, struct UringSlot* arena, int slotIdx)
+{
+    struct Conx* conx = &arena[slotIdx].conx;
+    struct io_uring_sqe* sqe = uringGetSqe(ring);
+
+    if(ring->fixedBuffs) {
+        sqe->opcode = conx->isWrite ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = 0;
+    }
+    else {
+        sqe->opcode = conx->isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = conx->sockfd;
+    sqe->addr = (unsigned long) (conx->ioBuff + conx->ioDone);
+    sqe->len = conx->ioLen - conx->ioDone;
+    sqe->off = (unsigned long long) -1;     // Sockets have no file position
+    sqe->user_data = (unsigned long long) slotIdx + 1;
+}
+
+
+/***********************************************************************
+ * Function Name: startSlot
+ * Description: This function places an accepted conx in a free slot
+    and queues its first read.
+ **********************************************************************/
+static void startSlot(struct Uring* ring, struct UringSlot* arena, int sockfd)
+{
+    int slotIdx;
+    struct UringSlot* slot;
+
+    for(slotIdx = 0; arena[slotIdx].inUse; slotIdx++);
+    slot = &arena[slotIdx];
+    slot->inUse = 1;
+    slot->expired = 0;
+    conxInit(&slot->conx, sockfd);
+    conxUseBuffers(&slot->conx, slot->fileBuff, slot->keyBuff);
+    queueConxIo(ring, arena, slotIdx);
+}
+
+
+/***********************************************************************
+ * Function Name: sweepSlots
+ * Description: This function shuts down the socket of every conx past
+    its deadline. Its in-flight read or write then completes (with 0 or
+    an error), and the completion releases the slot.
+ **********************************************************************/
+static void sweepSlots(struct UringSlot* arena, long long deadlineNs)
+{
+    int slotIdx;
+    long long now = statsNow();
+
+    for(slotIdx = 0; slotIdx < URING_CONX_MAX; slotIdx++)
+    {
+        if(arena[slotIdx].inUse && !arena[slotIdx].expired &&
+           now - arena[slotIdx].conx.requestStart >= deadlineNs) {
+            arena[slotIdx].expired = 1;
+            shutdown(arena[slotIdx].conx.sockfd, SHUT_RDWR);
+        }
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: releaseSlot
+ * Description: This function queues the close of a conx's socket and
+    frees its slot. The conx has no other op in flight at this point.
+ **********************************************************************/
+static void releaseSlot(struct Uring* ring, struct UringSlot* slot)
+{
+    struct io_uring_sqe* sqe = uringGetSqe(ring);
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot->conx.sockfd;
+    sqe->user_data = URING_IGNORE_TAG;
+
+    if(slot->expired) {
+        statsCount(STAT_EXPIRED, 1);
+    }
+    conxFree(&slot->conx);
+    slot->inUse = 0;
+}
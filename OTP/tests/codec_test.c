@@ -0,0 +1,189 @@
+/**********************************************************************************
+ Program Name: codec_test
+ Description: This program checks the codec kernels of otp_codec.c against the
+     scalar reference. For every length from 0 to PARITY_LEN_MAX and a few
+     chunk-sized ones, at every start offset up to ALIGN_MAX, each kernel the
+     CPU supports (sse2, avx2) must encrypt, decrypt, scan, pack and unpack
+     byte-identically to the scalar one, both into a separate buffer and in
+     place (packing into the start of the chars buffer, unpacking from its
+     tail), and decryption must undo encryption. Prints one line per kernel
+     and exits 1 on the first mismatch.
+     Syntax: codec_test
+ *********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../otp_codec.h"
+#include "../otp_proto.h"
+
+#define PARITY_LEN_MAX 300      // Every length up to this one is checked
+#define ALIGN_MAX 32            // Start offsets checked for each length
+#define BUFF_SIZE (CHUNK_SIZE + ALIGN_MAX + 64)
+
+// Outputs of one kernel for one input
+struct CodecRun {
+    char cipher[BUFF_SIZE];
+    char plain[BUFF_SIZE];
+    char packed[BUFF_SIZE];
+    char unpacked[BUFF_SIZE];
+    char inPlace[BUFF_SIZE];
+    size_t badIdx;
+};
+
+static char data[BUFF_SIZE];
+static char key[BUFF_SIZE];
+static struct CodecRun reference, candidate;
+
+
+/***********************************************************************
+ * Function Name: fillSymbols
+ * Description: This function fills len chars with random symbols of
+    the 27-symbol alphabet.
+ **********************************************************************/
+static void fillSymbols(char* buff, size_t len)
+{
+    size_t i;
+    int symbol;
+
+    for(i = 0; i < len; i++) {
+        symbol = rand() % 27;
+        buff[i] = (symbol == 0) ? ASCII_SPACE : (char) (symbol + ASCII_MIN);
+    }
+}
+
+
+/***********************************************************************
+ * Function Name: runCodec
+ * Description: This function runs every operation of the selected kernel
+    on len chars of data and key starting at offset, recording the
+    outputs in run. The in-place runs transform a copy of the message
+    onto itself, pack it into its own start and unpack it from its tail.
+ **********************************************************************/
+static void runCodec(struct CodecRun* run, size_t offset, size_t len)
+{
+    const char* msg = data + offset;
+
+    encryptData(msg, key + offset, run->cipher, len);
+    decryptData(run->cipher, key + offset, run->plain, len);
+    packSymbols(msg, run->packed, len);
+    unpackSymbols(run->packed, run->unpacked, len);
+    run->badIdx = findBadChar(msg, len);
+
+    memcpy(run->inPlace + offset, msg, len);
+    encryptData(run->inPlace + offset, key + offset, run->inPlace + offset, len);
+    decryptData(run->inPlace + offset, key + offset, run->inPlace + offset, len);
+    packSymbols(run->inPlace + offset, run->inPlace + offset, len);
+    memmove(run->inPlace + offset + len - PACKED_LEN(len), run->inPlace + offset, PACKED_LEN(len));
+    unpackSymbols(run->inPlace + offset + len - PACKED_LEN(len), run->inPlace + offset, len);
+}
+
+
+/***********************************************************************
+ * Function Name: checkRun
+ * Description: This function compares a kernel's outputs with the
+    scalar reference and checks that they round-trip. Returns 0, or
+    prints the first mismatch and returns -1.
+ **********************************************************************/
+static int checkRun(const char* name, size_t offset, size_t len)
+{
+    const char* msg = data + offset;
+    const char* failed = NULL;
+
+    if(memcmp(candidate.cipher, reference.cipher, len) != 0) {
+        failed = "encrypt differs from scalar";
+    }
+    else if(memcmp(candidate.plain, msg, len) != 0) {
+        failed = "decrypt does not undo encrypt";
+    }
+    else if(memcmp(candidate.packed, reference.packed, PACKED_LEN(len)) != 0) {
+        failed = "pack differs from scalar";
+    }
+    else if(memcmp(candidate.unpacked, msg, len) != 0) {
+        failed = "unpack does not undo pack";
+    }
+    else if(memcmp(candidate.inPlace + offset, msg, len) != 0) {
+        failed = "in-place round trip differs";
+    }
+    else if(candidate.badIdx != reference.badIdx) {
+        failed = "findBadChar differs from scalar";
+    }
+
+    if(failed != NULL) {
+        fprintf(stderr, "codec_test: %s: %s (len %zu, offset %zu)\n", name, failed, len, offset);
+        return -1;
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * Function Name: checkKernel
+ * Description: This function checks one kernel over every length and
+    offset, with the input all valid and then with one bad char planted.
+    Returns 0 or -1.
+ **********************************************************************/
+static int checkKernel(const char* name)
+{
+    static const size_t bigLens[] = { 1000, 4093, CHUNK_SIZE - 1, CHUNK_SIZE };
+    size_t len, offset, i, badAt;
+    int bad;
+
+    for(i = 0; i <= PARITY_LEN_MAX + sizeof(bigLens) / sizeof(bigLens[0]); i++)
+    {
+        len = (i <= PARITY_LEN_MAX) ? i : bigLens[i - PARITY_LEN_MAX - 1];
+        for(offset = 0; offset < ALIGN_MAX; offset += (len > PARITY_LEN_MAX ? 7 : 1))
+        {
+            for(bad = 0; bad < 2 && (bad == 0 || len > 0); bad++)
+            {
+                fillSymbols(data + offset, len);
+                fillSymbols(key + offset, len);
+                if(bad) {
+                    badAt = offset + (size_t) rand() % len;
+                    data[badAt] = (rand() % 2) ? 'a' : '@';
+                }
+
+                selectCodec("scalar");
+                runCodec(&reference, offset, len);
+                selectCodec(name);
+                runCodec(&candidate, offset, len);
+
+                // Ciphers of a bad input are unspecified, only the scan must agree
+                if(bad) {
+                    if(candidate.badIdx != reference.badIdx) {
+                        fprintf(stderr, "codec_test: %s: findBadChar differs from scalar (len %zu, offset %zu)\n",
+                                name, len, offset);
+                        return -1;
+                    }
+                }
+                else if(checkRun(name, offset, len) == -1) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+
+/***********************************************************************
+ * MAIN
+ **********************************************************************/
+int main(void) {
+    static const char* kernels[] = { "scalar", "sse2", "avx2" };
+    int i;
+
+    srand(27);
+    for(i = 0; i < 3; i++)
+    {
+        if(selectCodec(kernels[i]) == -1) {
+            printf("%-6s skipped (not supported here)\n", kernels[i]);
+            continue;
+        }
+        if(checkKernel(kernels[i]) == -1) {
+            return 1;
+        }
+        printf("%-6s ok\n", kernels[i]);
+    }
+    return 0;
+}
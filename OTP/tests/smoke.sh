@@ -0,0 +1,135 @@
+#!/bin/bash
+# Smoke test of the OTP daemons and clients. Starts otp_enc_d, otp_dec_d and otp_d on
+# local ports from OTP_TEST_PORT (default 24700) and checks the legacy handshake, header
+# requests, the busy reply and key uploads over raw sockets and through the clients.
+# Run from OTP after ./compileall (testall does both). Exits 1 if any check failed.
+
+cd "$(dirname "$0")/.." || exit 1
+
+PORT=${OTP_TEST_PORT:-24700}
+ENC_PORT=$PORT; DEC_PORT=$((PORT + 1)); BUSY_PORT=$((PORT + 2)); ANY_PORT=$((PORT + 3))
+LOOP_PORT=$((PORT + 4))
+WORK=$(mktemp -d)
+PIDS=()
+FAILS=0
+
+cleanup() {
+    exec 3<&- 6<&- 2>/dev/null
+    kill "${PIDS[@]}" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# check <what> <expected> <actual>
+check() {
+    if [ "$2" == "$3" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: expected '$2', got '$3'"
+        FAILS=$((FAILS + 1))
+    fi
+}
+
+# exchange <port> <printf format> <reply bytes>: sends one request on a fresh conx and
+# prints the reply bytes in hex
+exchange() {
+    exec 5<>"/dev/tcp/127.0.0.1/$1" || return
+    printf "$2" >&5
+    timeout 2 head -c "$3" <&5 | od -An -tx1 | tr -d ' \n'
+    exec 5<&-
+}
+
+# Request header (otp_proto.h step 9): magic, version, type, op, flags, length, key ID, offset
+header() {
+    printf 'OTPH\\x%02x%s\\x%02x\\x00\\x00\\x00\\x00\\x00\\x00\\x00\\x00\\x%02x' "$1" "$2" "$3" "$4"
+    printf '\\x00%.0s' {1..16}
+}
+
+hex() {
+    printf '%s' "$1" | od -An -tx1 | tr -d ' \n'
+}
+
+./otp_enc_d $ENC_PORT --keydir "$WORK/enc_keys" & PIDS+=($!)
+./otp_dec_d $DEC_PORT --keydir "$WORK/dec_keys" & PIDS+=($!)
+./otp_enc_d $BUSY_PORT --max-conns 1 --queue 0 & PIDS+=($!)
+./otp_d $ANY_PORT --io=epoll & PIDS+=($!)
+./otp_enc_d $LOOP_PORT --io=epoll --max-conns 1 --queue 0 --backlog 256 & PIDS+=($!)
+sleep 0.5
+
+echo "HELLO" > "$WORK/plain"
+echo "XMCKL" > "$WORK/key"
+head -c 5000 /dev/urandom | tr -dc 'A-Z ' > "$WORK/long"
+echo >> "$WORK/long"
+./keygen 5000 > "$WORK/pad"
+
+# Header requests, through the clients
+CIPHER="EROW "      # HELLO + XMCKL mod 27, space being 0
+check "otp_enc encrypts" "$CIPHER" "$(./otp_enc "$WORK/plain" "$WORK/key" $ENC_PORT)"
+echo "$CIPHER" > "$WORK/cipher"
+check "otp_dec decrypts" "HELLO" "$(./otp_dec "$WORK/cipher" "$WORK/key" $DEC_PORT)"
+./otp_enc "$WORK/long" "$WORK/pad" $ANY_PORT > "$WORK/long.cipher"
+check "otp_d round trip" "$(cat "$WORK/long")" "$(./otp_dec "$WORK/long.cipher" "$WORK/pad" $ANY_PORT)"
+./otp_enc "$WORK/plain" "$WORK/key" $DEC_PORT 2>/dev/null
+check "otp_enc refused by otp_dec_d" "2" "$?"
+
+# Header requests, raw
+check "raw header request" "$(hex "$CIPHER")" "$(exchange $ENC_PORT "$(header 1 E 0 5)HELLOXMCKL" 5)"
+check "header with bad version" "ff56" "$(exchange $ENC_PORT "$(header 2 E 0 5)HELLOXMCKL" 2)"
+check "header of the wrong type" "ff4e" "$(exchange $DEC_PORT "$(header 1 E 0 5)HELLOXMCKL" 2)"
+
+# Legacy handshake: type char, then the 64-bit length word, message and key chunks
+check "legacy request" "59$(hex "$CIPHER")" \
+      "$(exchange $ENC_PORT 'E\x00\x00\x00\x00\x00\x00\x00\x05HELLOXMCKL' 6)"
+check "legacy wrong type" "4e" "$(exchange $ENC_PORT 'D' 1)"
+check "legacy packed handshake" "50" "$(exchange $ENC_PORT 'e' 1)"
+
+# Busy reply: one conx fills the daemon (--max-conns 1, --queue 0)
+exec 3<>"/dev/tcp/127.0.0.1/$BUSY_PORT"
+printf 'E' >&3
+check "busy daemon serves its first conx" "59" "$(timeout 2 head -c 1 <&3 | od -An -tx1 | tr -d ' \n')"
+check "legacy busy reply" "42" "$(exchange $BUSY_PORT 'E' 2)"
+BUSY_HEX=$(exchange $BUSY_PORT "$(header 1 E 0 5)HELLOXMCKL" 2)
+check "header busy reply" "busy" "$([ "$BUSY_HEX" == "ff42" ] || [ "$BUSY_HEX" == "42" ] && echo busy || echo "$BUSY_HEX")"
+ERR=$(./otp_enc "$WORK/plain" "$WORK/key" $BUSY_PORT 2>&1 >/dev/null)
+check "otp_enc reports busy" "2 busy" "$? $(echo "$ERR" | grep -q busy && echo busy || echo "$ERR")"
+exec 3<&-
+sleep 0.3
+check "busy daemon recovers" "$CIPHER" "$(./otp_enc "$WORK/plain" "$WORK/key" $BUSY_PORT)"
+
+# Overload must not stall the event loop: silent conxs rejected while one conx is
+# served may not delay that conx's request
+exec 6<>"/dev/tcp/127.0.0.1/$LOOP_PORT"
+printf 'E' >&6
+timeout 2 head -c 1 <&6 >/dev/null
+SILENT=()
+for i in {1..100}; do
+    exec {fd}<>"/dev/tcp/127.0.0.1/$LOOP_PORT" && SILENT+=($fd)
+done
+START=$(date +%s%N)
+printf '\x00\x00\x00\x00\x00\x00\x00\x05HELLOXMCKL' >&6
+REPLY_HEX=$(timeout 2 head -c 5 <&6 | od -An -tx1 | tr -d ' \n')
+ELAPSED_MS=$((($(date +%s%N) - START) / 1000000))
+check "live conx served amid 100 silent rejects" "$(hex "$CIPHER") fast" \
+      "$REPLY_HEX $([ $ELAPSED_MS -lt 300 ] && echo fast || echo "took ${ELAPSED_MS} ms")"
+for fd in "${SILENT[@]}"; do
+    exec {fd}<&-
+done
+exec 6<&-
+
+# Key store: upload a pad to each daemon, then send message chunks only
+ENC_ID=$(./otp_enc --upload "$WORK/pad" $ENC_PORT)
+DEC_ID=$(./otp_dec --upload "$WORK/pad" $DEC_PORT)
+check "uploads name the pad alike" "$ENC_ID" "$DEC_ID"
+check "re-upload keeps the key ID" "$ENC_ID" "$(./otp_enc --upload "$WORK/pad" $ENC_PORT)"
+./otp_enc "$WORK/long" --key-id "$ENC_ID:0" $ENC_PORT > "$WORK/keyed.cipher"
+check "keyed encrypt matches the pad file" "$(cat "$WORK/long.cipher")" "$(cat "$WORK/keyed.cipher")"
+check "keyed decrypt" "$(cat "$WORK/long")" "$(./otp_dec "$WORK/keyed.cipher" --key-id "$DEC_ID:0" $DEC_PORT)"
+./otp_enc "$WORK/long" --key-id "0123456789abcdef" $ENC_PORT 2>/dev/null
+check "unknown key ID refused" "1" "$?"
+
+if [ $FAILS -gt 0 ]; then
+    echo "$FAILS check(s) failed"
+    exit 1
+fi
+echo "all checks passed"